@@ -0,0 +1,532 @@
+// Benchmarks for libx primitives, see README.md for how to build and run.
+//
+// Prints one CSV row per benchmark:
+//   benchmark,items,bytes,seconds,ns_per_item,mb_per_sec
+// Seconds is the best of BENCH_RUNS runs. Rows starting with "base." are the
+// C runtime baselines the libx rows are meant to be compared against.
+
+#define LIBX
+#include "../libx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef BENCH_RUNS
+#define BENCH_RUNS 5
+#endif
+
+// Size of the generated text corpus
+#define CORPUS_SIZE (64 * 1024 * 1024)
+
+// Files written for the directory benchmarks
+#define DIR_FILE_COUNT 2000
+#define DIR_FILE_SIZE (16 * 1024)
+
+#define BENCH_FILE "bench_tmp.dat"
+#define BENCH_DIR "bench_tmp_dir"
+
+static const char *filter = NULL;
+
+// Results are added here so the compiler cannot drop the benchmarked code
+static volatile u64 sink;
+
+#ifdef _WIN32
+
+#define makeDir(path) CreateDirectoryA(path, NULL)
+#define removeDir(path) RemoveDirectoryA(path)
+
+static f64 now(void)
+{
+    static f64 period = 0;
+    LARGE_INTEGER counter;
+    if (period == 0)
+    {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        period = 1.0 / (f64)freq.QuadPart;
+    }
+    QueryPerformanceCounter(&counter);
+    return (f64)counter.QuadPart * period;
+}
+
+// Opening a file without buffering makes the cache manager flush and purge
+// the cached pages of the file, so the next read has to go to disk.
+static void evictFile(const char *path)
+{
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+}
+
+#else
+
+#define makeDir(path) mkdir(path, 0755)
+#define removeDir(path) rmdir(path)
+
+static f64 now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (f64)t.tv_sec + (f64)t.tv_nsec * 1e-9;
+}
+
+// Clean pages are dropped from the page cache, so the file is synced first
+static void evictFile(const char *path)
+{
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+        return;
+    fdatasync(file);
+    posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+    close(file);
+}
+
+#endif
+
+static bool selected(const char *name)
+{
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+static void report(const char *name, u64 items, u64 bytes, f64 seconds)
+{
+    printf("%s,%llu,%llu,%.6f,%.3f,%.1f\n", name, items, bytes, seconds,
+           items ? seconds * 1e9 / (f64)items : 0.0,
+           bytes ? (f64)bytes / seconds / 1e6 : 0.0);
+    fflush(stdout);
+}
+
+// Runs setup and then the timed body BENCH_RUNS times, reporting the fastest
+// run. Setup is not timed.
+#define BENCH_SETUP(name, items, bytes, setup, ...)  \
+    do                                               \
+    {                                                \
+        if (!selected(name))                         \
+            break;                                   \
+        f64 best = 1e30;                             \
+        for (int run = 0; run < BENCH_RUNS; run++)   \
+        {                                            \
+            setup;                                   \
+            f64 start = now();                       \
+            __VA_ARGS__;                             \
+            f64 elapsed = now() - start;             \
+            if (elapsed < best)                      \
+                best = elapsed;                      \
+        }                                            \
+        report(name, items, bytes, best);            \
+    } while (0)
+
+#define BENCH(name, items, bytes, ...) BENCH_SETUP(name, items, bytes, (void)0, __VA_ARGS__)
+
+static u32 rng = 0x12345678;
+
+static u32 randomU32(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Fills buffer with log lines resembling our service logs
+static u64 makeCorpus(char *buffer, u64 size)
+{
+    static const char *levels[] = {"INFO ", "DEBUG", "WARN ", "ERROR"};
+    static const char *paths[] = {"/api/v1/items", "/api/v1/users/search", "/static/app.js", "/healthz", "/api/v2/Orders/history"};
+
+    u64 length = 0;
+    while (length + 256 < size)
+    {
+        length += snprintf(buffer + length, 256,
+                           "2024-03-%02u,%02u:%02u:%02u.%03u,%s,worker-%u,id=%u,path=%s,status=%u,bytes=%u,took=%u.%ums\n",
+                           randomU32() % 28 + 1, randomU32() % 24, randomU32() % 60, randomU32() % 60, randomU32() % 1000,
+                           levels[randomU32() % 4], randomU32() % 32, randomU32(), paths[randomU32() % 5],
+                           randomU32() % 8 == 0 ? 404 : 200, randomU32() % 100000, randomU32() % 500, randomU32() % 10);
+    }
+    return length;
+}
+
+static void benchArena(void)
+{
+    const u64 count = 4 * 1000 * 1000;
+    Arena a = ArenaNew(count * 32 + 4096);
+    Arena v = ArenaNewVirtual(count * 32 + 4096);
+    void **ptrs = malloc(count * sizeof(void *));
+
+    BENCH_SETUP("arena.alloc16", count, count * 16, ArenaReset(&a), {
+        for (u64 i = 0; i < count; i++)
+            sink += (u64)ArenaAlloc(&a, 16);
+    });
+    BENCH_SETUP("arena.alloc_aligned16", count, count * 16, ArenaReset(&a), {
+        for (u64 i = 0; i < count; i++)
+            sink += (u64)ArenaAllocAligned(&a, 13, 16);
+    });
+    BENCH_SETUP("arena.virtual_alloc16", count, count * 16, ArenaReset(&v), {
+        for (u64 i = 0; i < count; i++)
+            sink += (u64)ArenaAlloc(&v, 16);
+    });
+    BENCH("base.malloc16", count, count * 16, {
+        for (u64 i = 0; i < count; i++)
+            ptrs[i] = malloc(16);
+        for (u64 i = 0; i < count; i++)
+            free(ptrs[i]);
+    });
+
+    ArenaReset(&a);
+    Pool pool = PoolNew(&a, 48, 1024);
+    BENCH("pool.alloc_free48", count, count * 48, {
+        for (u64 i = 0; i < count; i++)
+        {
+            void *p = PoolAlloc(&pool);
+            sink += (u64)p;
+            PoolFree(&pool, p);
+        }
+    });
+    BENCH("base.malloc_free48", count, count * 48, {
+        for (u64 i = 0; i < count; i++)
+        {
+            void *p = malloc(48);
+            sink += (u64)p;
+            free(p);
+        }
+    });
+
+    free(ptrs);
+    ArenaFree(&v);
+    ArenaFree(&a);
+}
+
+static void benchString(String corpus)
+{
+    u64 n = corpus.length;
+
+    // A byte that never occurs, so every byte is scanned
+    BENCH("str.find_char", 1, n, sink += StrFind(corpus, '~'));
+    BENCH("base.memchr", 1, n, sink += (u64)memchr(corpus.str, '~', n));
+    BENCH("str.count_char", 1, n, sink += StrCount(corpus, '\n'));
+    BENCH("base.count_loop", 1, n, {
+        u64 count = 0;
+        for (u64 i = 0; i < n; i++)
+            count += corpus.str[i] == '\n';
+        sink += count;
+    });
+
+    String shortWord = STRING("took=999.9ms");
+    String longWord = STRING("path=/api/v1/users/search,status=404,bytes=99999");
+    BENCH("str.find_word_short", 1, n, sink += StrFindString(corpus, shortWord));
+    BENCH("base.strstr_short", 1, n, sink += (u64)strstr(corpus.str, shortWord.str));
+    BENCH("str.find_word_long", 1, n, sink += StrFindString(corpus, longWord));
+    BENCH("base.strstr_long", 1, n, sink += (u64)strstr(corpus.str, longWord.str));
+    BENCH("str.find_word_nocase", 1, n, sink += StrFindStringNoCase(corpus, STRING("API/V3")));
+
+    StrSearcher searcher = StrSearcherNew(longWord);
+    BENCH("str.searcher_long", 1, n, sink += StrSearch(&searcher, corpus));
+
+    u64 lines = StrCount(corpus, '\n');
+    BENCH("str.split_lines", lines, n, {
+        StringIter iter = StrToIterator(corpus);
+        while (Ok(iter))
+            sink += StrSplit(&iter, '\n').length;
+    });
+    BENCH("str.split_fields", lines * 11, n, {
+        StringIter iter = StrToIterator(corpus);
+        while (Ok(iter))
+            sink += StrSplitAny(&iter, ",\n").length;
+    });
+
+    Arena a = ArenaNewVirtual(1ull << 32);
+    BENCH("str.split_all", lines * 11, n, ArenaReset(&a), sink += len(StrSplitAll(&a, corpus, ",\n")));
+
+    // Compare every line with the next, most differ early, and with an equal
+    // line from a copy of the corpus
+    String *list = StrSplitAll(&a, corpus, "\n");
+    char *copy = ArenaAlloc(&a, n);
+    memcpy(copy, corpus.str, n);
+    String *same = StrSplitAll(&a, (String){.str = copy, .length = corpus.length}, "\n");
+    u32 count = len(list) - 1;
+    BENCH("str.compare", count, 0, {
+        for (u32 i = 0; i < count; i++)
+            sink += StrCompare(list[i], list[i + 1]);
+    });
+    BENCH("str.compare_equal", count, 0, {
+        for (u32 i = 0; i < count; i++)
+            sink += StrCompare(list[i], same[i]);
+    });
+    BENCH("base.memcmp_equal", count, 0, {
+        for (u32 i = 0; i < count; i++)
+            sink += list[i].length == same[i].length && memcmp(list[i].str, same[i].str, list[i].length) == 0;
+    });
+    BENCH("str.compare_nocase", count, 0, {
+        for (u32 i = 0; i < count; i++)
+            sink += StrCompareNoCase(list[i], same[i]);
+    });
+    BENCH("str.hash", count, 0, {
+        for (u32 i = 0; i < count; i++)
+            sink += StrHash(list[i]);
+    });
+
+    ArenaFree(&a);
+}
+
+static void benchList(void)
+{
+    const u32 count = 10 * 1000 * 1000;
+    u64 *fixed = list(u64, count);
+
+    BENCH_SETUP("list.append", count, count * 8, listHeader(fixed)->length = 0, {
+        for (u32 i = 0; i < count; i++)
+            append(fixed, i);
+    });
+    BENCH_SETUP("list.appendv", count, count * 8, listHeader(fixed)->length = 0, {
+        for (u32 i = 0; i < count; i++)
+            appendv(fixed, i);
+    });
+    BENCH_SETUP("list.pushv_growing", count, count * 8, (void)0, {
+        u64 *l = list(u64, 16);
+        for (u32 i = 0; i < count; i++)
+            pushv(l, i);
+        sink += len(l);
+        ListFree(l);
+    });
+    BENCH_SETUP("base.array_store", count, count * 8, (void)0, {
+        for (u32 i = 0; i < count; i++)
+            ((volatile u64 *)fixed)[i] = i;
+    });
+
+    ListFree(fixed);
+}
+
+static void benchMap(String corpus)
+{
+    Arena a = ArenaNewVirtual(1ull << 32);
+    String *fields = StrSplitAll(&a, corpus, ",\n");
+    u32 count = len(fields);
+    Arena m = ArenaNewVirtual(1ull << 32);
+
+    BENCH_SETUP("map.put_fields", count, 0, ArenaReset(&m), {
+        Map map = MapNew(&m, sizeof(u32), 1024);
+        for (u32 i = 0; i < count; i++)
+        {
+            u32 *v = MapPut(&map, fields[i]);
+            if (v != NULL)
+                (*v)++;
+        }
+        sink += map.count;
+    });
+
+    ArenaReset(&m);
+    Map map = MapNew(&m, sizeof(u32), 1024);
+    for (u32 i = 0; i < count; i++)
+        MapPut(&map, fields[i]);
+    BENCH("map.get_fields", count, 0, {
+        for (u32 i = 0; i < count; i++)
+            sink += (u64)MapGet(&map, fields[i]);
+    });
+
+    ArenaFree(&m);
+    ArenaFree(&a);
+}
+
+static void benchFormat(void)
+{
+    const u32 count = 2 * 1000 * 1000;
+    Arena a = ArenaNewVirtual(1ull << 32);
+
+    // Numbers as they appear in CSV columns
+    String *ints = ListCreateArena(&a, sizeof(String), count);
+    String *floats = ListCreateArena(&a, sizeof(String), count);
+    StrBuilder b = StrBuilderNew(&a, 64 * 1024 * 1024);
+    for (u32 i = 0; i < count; i++)
+    {
+        u32 start = b.length;
+        StrBuilderAppendf(&b, "%u", randomU32() % 10000000);
+        appendv(ints, (String){.str = b.str + start, .length = b.length - start});
+        StrBuilderAppendChar(&b, 0);
+
+        start = b.length;
+        StrBuilderAppendf(&b, "%u.%03u", randomU32() % 100000, randomU32() % 1000);
+        appendv(floats, (String){.str = b.str + start, .length = b.length - start});
+        StrBuilderAppendChar(&b, 0);
+    }
+    StrBuilderFinish(&b);
+
+    BENCH("parse.i64", count, 0, {
+        for (u32 i = 0; i < count; i++)
+            sink += StrToI64(ints[i]).value;
+    });
+    BENCH("base.strtoll", count, 0, {
+        for (u32 i = 0; i < count; i++)
+            sink += strtoll(ints[i].str, NULL, 10);
+    });
+    BENCH("parse.f64", count, 0, {
+        for (u32 i = 0; i < count; i++)
+            sink += (u64)StrToF64(floats[i]).value;
+    });
+    BENCH("base.strtod", count, 0, {
+        for (u32 i = 0; i < count; i++)
+            sink += (u64)strtod(floats[i].str, NULL);
+    });
+
+    Arena out = ArenaNewVirtual(1ull << 32);
+    BENCH_SETUP("format.builder", count, 0, ArenaReset(&out), {
+        StrBuilder sb = StrBuilderNew(&out, 0);
+        for (u32 i = 0; i < count; i++)
+            StrBuilderAppendf(&sb, "%d,%S,%.2f\n", i, ints[i], i * 0.25);
+        sink += StrBuilderFinish(&sb).length;
+    });
+    char *buffer = malloc(count * 64);
+    BENCH("base.snprintf", count, 0, {
+        u64 length = 0;
+        for (u32 i = 0; i < count; i++)
+            length += snprintf(buffer + length, 64, "%d,%.*s,%.2f\n", i, (int)ints[i].length, ints[i].str, i * 0.25);
+        sink += length;
+    });
+
+    free(buffer);
+    ArenaFree(&out);
+    ArenaFree(&a);
+}
+
+static void evictDir(void)
+{
+    char path[512];
+    for (u32 i = 0; i < DIR_FILE_COUNT; i++)
+    {
+        snprintf(path, sizeof(path), BENCH_DIR "/%u.txt", i);
+        evictFile(path);
+    }
+}
+
+static bool writeFile(const char *path, const char *data, u64 size)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+    bool ok = fwrite(data, 1, size, f) == size;
+    return fclose(f) == 0 && ok;
+}
+
+static void benchFiles(String corpus)
+{
+    u64 n = corpus.length;
+    if (!writeFile(BENCH_FILE, corpus.str, n))
+    {
+        fprintf(stderr, "bench: could not write " BENCH_FILE "\n");
+        return;
+    }
+
+    BENCH("file.read_warm", 1, n, {
+        File f = XReadFile(BENCH_FILE);
+        sink += f.size;
+        XFreeFile(&f);
+    });
+    BENCH_SETUP("file.read_cold", 1, n, evictFile(BENCH_FILE), {
+        File f = XReadFile(BENCH_FILE);
+        sink += f.size;
+        XFreeFile(&f);
+    });
+
+    Arena a = ArenaNewVirtual(1ull << 32);
+    BENCH_SETUP("file.read_arena_warm", 1, n, ArenaReset(&a), sink += XReadFileArena(&a, BENCH_FILE).size);
+    BENCH("file.map_count_lines_warm", 1, n, {
+        File f = XMapFile(BENCH_FILE);
+        sink += StrCount((String){.str = f.data, .length = f.size}, '\n');
+        XUnmapFile(&f);
+    });
+    BENCH_SETUP("file.stream_cold", 1, n, evictFile(BENCH_FILE), {
+        FileStream s = XOpenStream(BENCH_FILE, 4 * 1024 * 1024);
+        for (String chunk = FileStreamNext(&s); Ok(chunk); chunk = FileStreamNext(&s))
+            sink += chunk.length;
+        XCloseStream(&s);
+    });
+    BENCH("base.fread_warm", 1, n, {
+        FILE *f = fopen(BENCH_FILE, "rb");
+        char *buffer = malloc(n);
+        sink += fread(buffer, 1, n, f);
+        free(buffer);
+        fclose(f);
+    });
+
+    makeDir(BENCH_DIR);
+    char path[512];
+    for (u32 i = 0; i < DIR_FILE_COUNT; i++)
+    {
+        snprintf(path, sizeof(path), BENCH_DIR "/%u.txt", i);
+        writeFile(path, corpus.str + (u64)i * DIR_FILE_SIZE % (n - DIR_FILE_SIZE), DIR_FILE_SIZE);
+    }
+
+    u64 dirBytes = (u64)DIR_FILE_COUNT * DIR_FILE_SIZE;
+    BENCH_SETUP("dir.read_files_warm", DIR_FILE_COUNT, dirBytes, ArenaReset(&a), {
+        File *files = XReadDirFiles(&a, BENCH_DIR);
+        sink += len(files);
+        ListFree(files);
+    });
+    BENCH_SETUP("dir.read_files_cold", DIR_FILE_COUNT, dirBytes, (ArenaReset(&a), evictDir()), {
+        File *files = XReadDirFiles(&a, BENCH_DIR);
+        sink += len(files);
+        ListFree(files);
+    });
+    BENCH_SETUP("dir.walk", DIR_FILE_COUNT, 0, ArenaReset(&a), {
+        String *paths = XWalkDir(&a, BENCH_DIR, "*.txt", WALK_RECURSIVE);
+        if (paths != NULL)
+            sink += len(paths);
+        ListFree(paths);
+    });
+    BENCH_SETUP("base.fopen_dir_warm", DIR_FILE_COUNT, dirBytes, (void)0, {
+        char *buffer = malloc(DIR_FILE_SIZE);
+        for (u32 i = 0; i < DIR_FILE_COUNT; i++)
+        {
+            snprintf(path, sizeof(path), BENCH_DIR "/%u.txt", i);
+            FILE *f = fopen(path, "rb");
+            sink += fread(buffer, 1, DIR_FILE_SIZE, f);
+            fclose(f);
+        }
+        free(buffer);
+    });
+
+    for (u32 i = 0; i < DIR_FILE_COUNT; i++)
+    {
+        snprintf(path, sizeof(path), BENCH_DIR "/%u.txt", i);
+        remove(path);
+    }
+    removeDir(BENCH_DIR);
+    remove(BENCH_FILE);
+    ArenaFree(&a);
+}
+
+int main(int argc, char **argv)
+{
+    // Usage: bench [filter] [corpus file]
+    if (argc > 1 && strcmp(argv[1], "all") != 0)
+        filter = argv[1];
+
+    char *data = malloc(CORPUS_SIZE + 1);
+    u64 size = 0;
+    if (argc > 2)
+    {
+        File f = XReadFile(argv[2]);
+        if (!Ok(f))
+        {
+            fprintf(stderr, "bench: could not read %s\n", argv[2]);
+            return 1;
+        }
+        free(data);
+        data = f.data;
+        size = f.size;
+    }
+    else
+        size = makeCorpus(data, CORPUS_SIZE);
+    data[size] = 0;
+
+    String corpus = {.str = data, .length = size};
+
+    printf("benchmark,items,bytes,seconds,ns_per_item,mb_per_sec\n");
+    benchArena();
+    benchString(corpus);
+    benchList();
+    benchMap(corpus);
+    benchFormat();
+    benchFiles(corpus);
+    return 0;
+}
@@ -1,7 +1,18 @@
 #pragma once
 
+// Strict -std=c11 hides mmap flags, pread and dirent.d_type. Only takes effect
+// when libx.h is included before any system header.
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include <stdbool.h>
+#include <stddef.h>
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <dirent.h>
+#endif
 
 typedef unsigned char u8;
 typedef unsigned short u16;
@@ -12,6 +23,7 @@ typedef short i16;
 typedef int i32;
 typedef long long i64;
 typedef float f32;
+typedef double f64;
 
 #define defer(f) for (int __defer_i = 0; !__defer_i; (f, __defer_i++))
 
@@ -28,6 +40,13 @@ typedef enum error
     ERR_ITERATION_FINISH,
     ERR_FILE_NOT_FOUND,
     ERR_NULL_PTR,
+    ERR_ARENA_INVALID_MARK,
+    ERR_POOL_FOREIGN_PTR,
+    ERR_ARENA_OWNED,
+    ERR_LIST_INDEX,
+    ERR_FILE_WRITE,
+    ERR_PARSE_INVALID,
+    ERR_PARSE_OVERFLOW,
 } error;
 
 typedef struct String
@@ -40,6 +59,13 @@ typedef struct String
 #define STRING(s) \
     (String) { .err = 0, .length = strlen((s)), .str = (s) }
 
+// String with its hash stored next to it, see StrHashed
+typedef struct HString
+{
+    String s;
+    u64 hash;
+} HString;
+
 typedef struct StringIter
 {
     String s;
@@ -47,15 +73,139 @@ typedef struct StringIter
     error err;
 } StringIter;
 
+// Substring given as position in a base string. Half the size of String and has no error,
+// for large token arrays. See StrSplitSpans.
+typedef struct StrSpan
+{
+    u32 offset;
+    u32 length;
+} StrSpan;
+
+// Longest string SmallStr stores inline
+#define SMALL_STR_MAX 15
+
+// Owned string of 16 bytes. Strings up to SMALL_STR_MAX bytes are stored inline, longer ones
+// are copied to an arena. The last byte is SMALL_STR_MAX - length for inline strings, so a
+// full inline string is still null terminated, and SMALL_STR_HEAP otherwise.
+typedef union SmallStr
+{
+    char buf[SMALL_STR_MAX + 1];
+    struct
+    {
+        char *str;
+        u32 length; // Error when str is NULL
+        u8 _pad[SMALL_STR_MAX - sizeof(char *) - sizeof(u32)];
+        u8 tag;
+    } heap;
+} SmallStr;
+
+// The heap tag must overlap the last inline byte
+_Static_assert(offsetof(SmallStr, heap.tag) == SMALL_STR_MAX, "SmallStr heap tag is not the last byte");
+
+typedef enum ArenaKind
+{
+    ARENA_FIXED = 0, // Single block, fails when full
+    ARENA_GROWABLE,  // Chain of blocks from the default allocator
+    ARENA_VIRTUAL,   // Reserved address range, committed as pos advances
+    ARENA_SHARED,    // Virtual arena which is safe to allocate from on multiple threads
+} ArenaKind;
+
+#ifdef LIBX_STATS
+// Allocation counters of an arena, see ArenaGetStats. Only with LIBX_STATS defined.
+typedef struct ArenaStats
+{
+    u64 peak;       // Most bytes in use at once
+    u64 allocs;     // Number of allocations
+    u64 bytes;      // Bytes allocated in total, including alignment padding
+    u64 failures;   // Number of allocations that failed
+    void *failSite; // Return address of the last failed allocation, look it up in the debugger
+} ArenaStats;
+
+// Process wide counters, see XGetStats. Only with LIBX_STATS defined.
+typedef struct XStats
+{
+    u64 fileReads;      // Files read with XReadFile and XReadFileArena
+    u64 fileBytes;      // Bytes read by them
+    u64 fileReadMicros; // Time spent in them
+    u64 listGrows;      // Lists that grew
+    u64 listFull;       // Appends dropped because the list was full
+} XStats;
+#endif
+
 typedef struct Arena
 {
     void *memory;
-    int size;
-    int pos;
+    u64 size;
+    u64 pos;
     int depth; // 0 for base arena
     error err;
+
+    ArenaKind kind;
+    struct ArenaBlock *block; // Current block of growable arena
+    u64 reserved;             // Total bytes held by all blocks
+    u64 maxReserve;           // Growable arenas fail when reserved would exceed this
+    u64 committed;            // Committed bytes of virtual arena
+
+#ifdef LIBX_STATS
+    ArenaStats stats;
+#endif
 } Arena;
 
+// Saved arena position, see ArenaSave
+typedef struct ArenaMark
+{
+    struct ArenaBlock *block;
+    u64 pos;
+} ArenaMark;
+
+// Fixed size object pool carved out of an arena
+typedef struct Pool
+{
+    void *memory;
+    void *free;   // Intrusive list of freed slots
+    u64 slotSize; // Object size rounded up to hold a free list pointer
+    u64 count;
+    u64 used; // Slots handed out at least once, the rest are untouched
+    error err;
+} Pool;
+
+// Stored right before the first item of a list, see listHeader
+typedef struct ListHeader
+{
+    int length;
+    int cap;
+    int dataSize;
+    error err;
+    Arena *arena; // Set for lists allocated with ListCreateArena
+    u64 _pad;     // Keeps list data 16 byte aligned
+} ListHeader;
+
+// Open addressing hash map allocated in an arena, see MapNew
+typedef struct Map
+{
+    Arena *arena;
+    u8 *ctrl;     // Per slot: empty, deleted, or the low 7 bits of the keys hash
+    void *keys;   // HString or u64 per slot
+    void *values; // valueSize bytes per slot
+    u32 cap;      // Number of slots, power of two
+    u32 count;
+    u32 deleted;
+    u32 valueSize;
+    bool stringKeys;
+    error err;
+} Map;
+
+// Deduplicating string pool, see InternerNew
+typedef struct Interner
+{
+    Arena *arena;
+    Map ids;         // Interned string to id
+    String *strings; // Interned string by id
+    u32 count;
+    u32 cap;
+    error err;
+} Interner;
+
 typedef struct File
 {
     char filepath[260];
@@ -66,15 +216,148 @@ typedef struct File
     bool open;  // If true, file contains a data field with its contents
     bool isDir; // True if the filepath corresponds with a directory
     bool readOnly;
+    bool mapped;  // Data is a read only view of the file, see XMapFile
+    bool inArena; // Data is owned by an arena, see XReadFileArena
 } File;
 
+// Native handle of an open file, a file descriptor on POSIX
+#ifdef _WIN32
+typedef HANDLE FileHandle;
+#else
+typedef int FileHandle;
+#endif
+
 typedef struct FileIter
 {
+#ifdef _WIN32
     WIN32_FIND_DATA data;
     HANDLE hFind;
+#else
+    DIR *dir;
+    struct dirent *entry; // Next entry, read ahead like FindNextFile
+#endif
     error err;
 } FileIter;
 
+// Chunked reader over a file, see XOpenStream
+typedef struct FileStream
+{
+    FileHandle file;
+    struct StreamBuffer *buffers; // Rotating read buffers, NULL when closed
+    u64 size;
+    u64 offset;     // File offset of the next read to issue
+    u32 chunkSize;
+    u32 next;       // Buffer returned by the next call to FileStreamNext
+    u32 carry;      // Length of the unfinished line at the end of the previous chunk
+    bool started;
+    error err;
+} FileStream;
+
+// Buffered writer over a file or console handle, see XWriterNew
+typedef struct Writer
+{
+    FileHandle handle;
+    char *buffer;
+    u32 length;
+    u32 cap;
+    bool heap;                 // Buffer is owned by the writer
+    struct WriterAsync *async; // Background writer thread, NULL when writes happen on flush
+    error err;
+} Writer;
+
+// Flags for XWalkDir
+typedef enum WalkFlags
+{
+    WALK_RECURSIVE = 1 << 0, // Walk subdirectories
+    WALK_DIRS = 1 << 1,      // Include directories in the result
+    WALK_PARALLEL = 1 << 2,  // Walk directories on multiple threads, result order is not stable
+} WalkFlags;
+
+// Called by XReadFilesEx as each file finishes. Index is the files position in the path list.
+typedef void (*FileCallback)(File *f, u32 index, void *ctx);
+
+// Precompiled search word for repeated searches, see StrSearcherNew
+typedef struct StrSearcher
+{
+    String word;
+    u32 skip[256]; // Horspool shift per byte value
+    error err;
+} StrSearcher;
+
+// String built by appending in place in an arena, see StrBuilderNew
+typedef struct StrBuilder
+{
+    Arena *arena;
+    char *str;
+    u32 length;
+    u32 cap;
+    error err;
+} StrBuilder;
+
+// Results of number parsing, see StrToI64
+typedef struct ParsedI64
+{
+    i64 value;
+    error err;
+} ParsedI64;
+
+typedef struct ParsedU64
+{
+    u64 value;
+    error err;
+} ParsedU64;
+
+typedef struct ParsedF64
+{
+    f64 value;
+    error err;
+} ParsedF64;
+
+// Reader of delimiter separated records, see CsvNew
+typedef struct CsvReader
+{
+    char *data;
+    u64 size;
+    u64 pos;
+    char delim;
+    String *fields; // Fields of the current row, list allocated in the arena
+    u64 row;        // Number of rows read
+    error err;
+} CsvReader;
+
+// Job run by JobSubmit. Scratch is an arena of the running thread which is reset after the job.
+typedef void (*JobFunc)(void *arg, Arena *scratch);
+// Called by JobParallelFor for each item of a list.
+typedef void (*JobForFunc)(void *item, u32 index, void *ctx, Arena *scratch);
+
+// Number of unfinished jobs, see JobWait. Zero initialize before use.
+typedef struct JobCounter
+{
+    volatile u64 pending;
+} JobCounter;
+
+// Work stealing thread pool, see JobSystemNew
+typedef struct JobSystem
+{
+    struct JobState *state;
+    u32 threads;
+    error err;
+} JobSystem;
+
+// Bounded lock free queue for one producer and one consumer thread, see SpscNew
+typedef struct SpscQueue
+{
+    struct SpscState *state;
+    error err;
+} SpscQueue;
+
+// Bounded lock free queue for any number of producer and consumer threads, see MpmcNew
+typedef struct MpmcQueue
+{
+    struct MpmcState *state;
+    error err;
+} MpmcQueue;
+
 // Returns string representation of error code.
 char *XError(error e);
 
@@ -92,26 +375,114 @@ void panic(char *msg);
 
 // Allocates new arena with given size. Sets err value on failure.
 Arena ArenaNew(u64 size);
+// Allocates new growable arena. Links new blocks when full, up to maxReserve bytes in total.
+// Existing pointers never move.
+Arena ArenaNewGrowable(u64 initial, u64 maxReserve);
+// Reserves address space for a virtual arena. Pages are committed as the arena grows.
+Arena ArenaNewVirtual(u64 reserve);
+// Reserves a virtual arena which ArenaAlloc can be called on from several threads at once.
+// Other arena functions on it are not thread safe.
+Arena ArenaNewShared(u64 reserve);
+// Returns a fixed child arena carved from a shared arena, meant to be used by a single thread.
+// Chunks are cache line aligned and cannot be released.
+Arena ArenaChunk(Arena *shared, u64 size);
 // Allocates a new temporary arena within the parent.
 Arena ArenaTemp(Arena *parent, u64 size);
 // Releases temporary arena. Fails if allocations to the parent were made after the temp was created.
 error ArenaReleaseTemp(Arena *temp, Arena *parent);
 // Returns NULL on failure and sets err value.
 void *ArenaAlloc(Arena *a, u64 size);
-// Frees internal memory pointer. Sets ERR_MEMORY_FREED.
+// Same as ArenaAlloc, but the returned pointer is aligned to align, which must be a power of two.
+void *ArenaAllocAligned(Arena *a, u64 size, u64 align);
+// Returns a mark of the current arena position.
+ArenaMark ArenaSave(Arena *a);
+// Frees all allocations made after the mark was saved. Clears ERR_NO_MEMORY.
+error ArenaRestore(Arena *a, ArenaMark mark);
+// Returns a scratch arena local to the calling thread which is not the conflict arena.
+// Use with ArenaSave and ArenaRestore. Conflict may be NULL.
+Arena *ArenaScratch(Arena *conflict);
+// Frees the scratch arenas of the calling thread.
+void ArenaFreeScratch(void);
+// Sets pos to 0. Growable arenas free all but the first block, virtual arenas decommit their pages.
+error ArenaReset(Arena *a);
+// Frees internal memory pointer, and all blocks of a growable arena. Sets ERR_MEMORY_FREED.
 error ArenaFree(Arena *a);
+#ifdef LIBX_STATS
+// Returns allocation counters of the arena.
+ArenaStats ArenaGetStats(Arena *a);
+// Returns snapshot of the process wide counters.
+XStats XGetStats(void);
+// Sets all process wide counters to 0.
+void XResetStats(void);
+#endif
+
+// Allocates a pool of count objects of objSize bytes in the arena. Sets err value on failure.
+Pool PoolNew(Arena *a, u64 objSize, u64 count);
+// Returns a free object from the pool. Returns NULL when all objects are in use.
+void *PoolAlloc(Pool *p);
+// Returns the object to the pool. Fails if obj was not allocated by the pool.
+error PoolFree(Pool *p, void *obj);
 
 // Reads file and returns it. Sets error in File.err on failure.
 // Uses default allocator, remember to call XFreeFile().
 File XReadFile(const char *filepath);
-// Use only when not allocated with Arena.
+// Reads file into arena memory and returns it. Sets error in File.err on failure.
+// Freed with the arena, do not call XFreeFile().
+File XReadFileArena(Arena *a, const char *filepath);
+// Use only when not allocated with Arena. Unmaps mapped files.
 error XFreeFile(File *f);
+// Maps file into memory and returns it without copying. Data is read only and not NULL terminated.
+// Remember to call XUnmapFile().
+File XMapFile(const char *filepath);
+// Unmaps file returned by XMapFile.
+error XUnmapFile(File *f);
 // Returns file iterator for given directory
 FileIter XReadDir(const char *path);
 // Returns next file if any. Closes iterator when done.
 File FileIterNext(FileIter *iter);
 // Closes file iterator. Only necessary if iteration is stopped early.
 error XCloseFileIter(FileIter *iter);
+// Opens file for streaming in chunks of up to chunkSize bytes. The next chunks are read in
+// the background while the current one is processed. Remember to call XCloseStream().
+FileStream XOpenStream(const char *filepath, u32 chunkSize);
+// Returns next chunk of the stream. Chunks end at a line boundary, excluding the newline, unless a
+// line is longer than chunkSize. A newline ending the file is excluded too. The chunk is valid
+// until the next call. Sets ERR_ITERATION_FINISH after the last chunk.
+String FileStreamNext(FileStream *s);
+// Cancels pending reads and frees the stream.
+error XCloseStream(FileStream *s);
+// Reads all files concurrently into the arena and calls cb for each file as it completes, in
+// any order. Errors for single files are set in File.err. Returns error if the batch could not start.
+error XReadFilesEx(Arena *a, const char **paths, u32 count, FileCallback cb, void *ctx);
+// Reads all files concurrently into the arena. Returns list of files in the same order as paths.
+// Free list with ListFree().
+File *XReadFiles(Arena *a, const char **paths, u32 count);
+// Reads all files in directory concurrently into the arena. Returns list of files.
+// Free list with ListFree().
+File *XReadDirFiles(Arena *a, const char *path);
+// Returns list of full paths below path. Filter is a list of globs separated by ';', eg. "*.c;*.h",
+// matched against file names. NULL matches all. Paths are allocated in the arena and NULL terminated.
+// Free list with ListFree().
+String *XWalkDir(Arena *a, const char *path, const char *filter, u32 flags);
+// Returns writer which collects output in a buffer of size bytes and writes it to the handle in
+// one write per full buffer. The buffer is allocated in the arena, or on the heap if NULL.
+// Size 0 uses a 1 MB buffer. Remember to call WriterClose().
+Writer XWriterNew(FileHandle handle, Arena *a, u32 size);
+// Same as XWriterNew, with two heap buffers. A background thread writes one while the other is
+// filled. Remember to call WriterClose().
+Writer XWriterNewAsync(FileHandle handle, u32 size);
+// Appends s to the writer. Does nothing if s has an error.
+void WriterWrite(Writer *w, String s);
+// Appends s and a newline to the writer. Does nothing if s has an error.
+void WriterWriteLine(Writer *w, String s);
+// Appends n bytes of data to the writer
+void WriterWriteRaw(Writer *w, const char *data, u32 n);
+// Writes all buffered output to the handle.
+error WriterFlush(Writer *w);
+// Flushes writer, stops its thread and frees its buffers. Does not close the handle.
+error WriterClose(Writer *w);
+// Sends output of prints() to the writer instead of stdout. NULL sets it back to stdout.
+void XSetPrintWriter(Writer *w);
 
 // Note that all of these functions will short circuit/return default/error
 // values if the string passed has an error. Therefore it is safe to chain
@@ -132,35 +503,189 @@ u32 StrCount(String s, char c);
 String StrUpper(Arena *a, String s);
 // Returns new string converted to lower case
 String StrLower(Arena *a, String s);
+// Converts string to upper case in place and returns it
+String StrUpperInPlace(String s);
+// Converts string to lower case in place and returns it
+String StrLowerInPlace(String s);
 // Allocates and returns new concatinated string.
 String StrConcat(Arena *a, String s1, String s2);
+// Returns builder with room for cap bytes in the arena. Appends grow it in place while it is
+// the last allocation in the arena, nothing else should be allocated in it until finished.
+StrBuilder StrBuilderNew(Arena *a, u32 cap);
+// Appends s to the builder
+void StrBuilderAppend(StrBuilder *b, String s);
+// Appends a single character to the builder
+void StrBuilderAppendChar(StrBuilder *b, char c);
+// Appends decimal representation of v
+void StrBuilderAppendInt(StrBuilder *b, i64 v);
+// Appends v with the given number of decimals
+void StrBuilderAppendFloat(StrBuilder *b, f64 v, u32 decimals);
+// Appends formatted text. Supports %d %i %u %x %X (with l, ll, z), %f, %c, %s, %S for String,
+// and %%, with optional - or 0 flag, width and precision, eg. %08.3f or %-*s.
+void StrBuilderAppendf(StrBuilder *b, const char *fmt, ...);
+// Returns the built string and gives unused capacity back to the arena.
+String StrBuilderFinish(StrBuilder *b);
+// Parses the whole string as a decimal integer with optional sign. Sets ERR_PARSE_INVALID if s
+// is not a number, and ERR_PARSE_OVERFLOW if it does not fit.
+ParsedI64 StrToI64(String s);
+// Same as StrToI64, for unsigned integers.
+ParsedU64 StrToU64(String s);
+// Parses the whole string as a hexadecimal integer, with or without 0x prefix.
+ParsedU64 StrHexToU64(String s);
+// Parses the whole string as a floating point number, eg. -1.5e3, inf, or nan. Correctly rounded.
+ParsedF64 StrToF64(String s);
 // Returns index of first occurence of c. -1 if not found.
 u32 StrFind(String s, char c);
 // Returns index of first occurence of word, -1 if not found.
 u32 StrFindWord(String s, char *word);
 // Returns index of first occurence of word, -1 if not found.
 u32 StrFindString(String s, String word);
+// Returns searcher for word which can be reused across many strings. Word is not copied.
+StrSearcher StrSearcherNew(String word);
+// Returns index of first occurence of the searchers word, -1 if not found.
+u32 StrSearch(StrSearcher *searcher, String s);
 // Returns true if strings are identical
 bool StrCompare(String a, String b);
+// Returns true if strings are identical, ignoring ASCII case
+bool StrCompareNoCase(String a, String b);
+// Returns index of first occurence of word ignoring ASCII case, -1 if not found.
+u32 StrFindStringNoCase(String s, String word);
+// Returns 64 bit hash of string. Strings with errors hash to 0.
+u64 StrHash(String s);
+// Returns string together with its hash
+HString StrHashed(String s);
+// Returns true if strings are identical. Compares hashes first.
+bool StrHashedCompare(HString a, HString b);
 
 StringIter StrToIterator(String s);
 StringIter StrToIteratorEx(char *string, u32 length);
 // Returns string before next occurance of the delimeter. Can give empty string.
 String StrSplit(StringIter *iter, char delim);
+// Returns string before next occurance of any of the delimeters. Can give empty string.
+String StrSplitAny(StringIter *iter, const char *delims);
+// Splits s on any of the delimeters and returns list of all parts, allocated in the arena.
+String *StrSplitAll(Arena *a, String s, const char *delims);
+// Same as StrSplitAll, returns parts as spans into s.
+StrSpan *StrSplitSpans(Arena *a, String s, const char *delims);
+// Returns span of s within base. s must be a substring of base.
+StrSpan StrToSpan(String base, String s);
+// Returns the substring of base at span. Span is not bounds checked.
+String StrSpanGet(String base, StrSpan span);
+// Returns owned copy of s. Only strings longer than SMALL_STR_MAX are allocated in the arena,
+// a may be NULL if s is known to be short.
+SmallStr SmallStrNew(Arena *a, String s);
+// Returns string stored in s, valid as long as s is. Has an error if SmallStrNew failed.
+String SmallStrGet(const SmallStr *s);
+// Returns length of s, 0 if s is NULL
+u32 SmallStrLen(const SmallStr *s);
+// Returns true if strings are identical. Short strings are compared without a memcmp.
+bool SmallStrCompare(const SmallStr *a, const SmallStr *b);
 
 // Returns pointer to new list
 void *ListCreate(size_t dataSize, size_t length);
-// Free list and header
+// Returns pointer to new list allocated in the arena. Growing it is free while it is the
+// last allocation in the arena.
+void *ListCreateArena(Arena *a, size_t dataSize, size_t length);
+// Free list and header. Does nothing for arena lists.
 void ListFree(void *list);
 // Returns length of list. Only valid if appended to with ListAppend or append.
 int ListLen(void *list);
 // Return capacity of list, given in declaration.
 int ListCap(void *list);
-// Appends item to end of list. Fails if full.
+// Appends item to end of list. Sets ERR_LIST_FULL if full.
 void ListAppend(void *list, u64 item);
+// Appends item to end of list, doubling its capacity if full. Returns the list, which may have moved.
+void *ListPush(void *list, u64 item);
+// Grows capacity to at least cap. Returns the list, which may have moved.
+void *ListReserve(void *list, size_t cap);
+// Shrinks capacity to the length of the list. Returns the list, which may have moved.
+void *ListShrink(void *list);
+// Appends count items, growing the list if needed. Returns the list, which may have moved.
+void *ListExtend(void *list, const void *items, size_t count);
+// Inserts count items before index, growing the list if needed. Returns the list, which may have moved.
+// Sets ERR_LIST_INDEX if index is past the end.
+void *ListInsertN(void *list, size_t index, const void *items, size_t count);
+// Returns error of list, eg. ERR_LIST_FULL or ERR_NO_MEMORY from a failed append.
+error ListErr(void *list);
 // Removes and returns last element in list.
 void *ListPop(void *list);
 
+// Returns new map with String keys and values of valueSize bytes, allocated in the arena.
+// Keys are not copied. Sets err value on failure.
+Map MapNew(Arena *a, u32 valueSize, u32 cap);
+// Same as MapNew, with u64 keys.
+Map MapNewU64(Arena *a, u32 valueSize, u32 cap);
+// Returns pointer to value of key, NULL if not found. Valid until the next MapPut.
+void *MapGet(Map *m, String key);
+// Returns pointer to value of key, inserting a zeroed value if not found. Returns NULL on failure.
+void *MapPut(Map *m, String key);
+// Removes key from map. Returns false if not found.
+bool MapDelete(Map *m, String key);
+// Same as MapGet, with u64 keys.
+void *MapGetU64(Map *m, u64 key);
+// Same as MapPut, with u64 keys.
+void *MapPutU64(Map *m, u64 key);
+// Same as MapDelete, with u64 keys.
+bool MapDeleteU64(Map *m, u64 key);
+
+// Returns new intern pool allocated in the arena, with room for cap strings before growing.
+Interner InternerNew(Arena *a, u32 cap);
+// Returns the interned copy of s. Equal strings share the same memory.
+String StrIntern(Interner *in, String s);
+// Returns id of s, interning it if not seen before. Ids are given out in order from 0.
+// Returns -1 on failure.
+u32 StrInternId(Interner *in, String s);
+// Returns interned string with the given id.
+String InternerGet(Interner *in, u32 id);
+
+// Returns reader of the records in data, with fields separated by delim, eg. a file from XMapFile.
+// Fields are slices of data and are never copied.
+CsvReader CsvNew(Arena *a, char *data, u64 size, char delim);
+// Returns list of fields in the next row, valid until the next call. Quoted fields are returned
+// without their quotes, use CsvUnquote for fields with escaped "" quotes inside. Trailing CR is
+// removed. Returns NULL and sets ERR_ITERATION_FINISH after the last row.
+String *CsvNextRow(CsvReader *r);
+// Returns field with escaped "" quotes replaced by ". Only allocates if field has quotes.
+String CsvUnquote(Arena *a, String field);
+// Splits data into up to count chunks ending at line boundaries, to be read by CsvNew on separate
+// threads. Quoted fields containing newlines could be split. Free list with ListFree().
+String *CsvSplitChunks(char *data, u64 size, u32 count);
+
+// Returns job system with the given number of worker threads, 0 for one per processor. Each
+// worker has its own job queue and steals from the others when it runs out.
+JobSystem JobSystemNew(u32 threads);
+// Queues fn(arg) to run on a worker. Counter is incremented now and decremented when the job is
+// done, and may be NULL. Runs the job right away if the job system has an error.
+void JobSubmit(JobSystem *js, JobFunc fn, void *arg, JobCounter *counter);
+// Waits until all jobs of the counter are done, running queued jobs in the meantime.
+void JobWait(JobSystem *js, JobCounter *counter);
+// Calls fn for each item in list, split into batches across the workers. Returns when all are done.
+void JobParallelFor(JobSystem *js, void *list, JobForFunc fn, void *ctx);
+// Runs the remaining jobs, stops the workers and frees the job system.
+error JobSystemFree(JobSystem *js);
+
+// Returns queue of items of itemSize bytes, with room for cap rounded up to a power of two.
+// Allocated in the arena.
+SpscQueue SpscNew(Arena *a, u32 itemSize, u32 cap);
+// Copies item into the queue. Returns false if full. Only call from the producer thread.
+bool SpscPush(SpscQueue *q, const void *item);
+// Copies the oldest item out of the queue. Returns false if empty. Only call from the consumer thread.
+bool SpscPop(SpscQueue *q, void *item);
+// Pushes up to count items from the array. Returns the number pushed.
+u32 SpscPushN(SpscQueue *q, const void *items, u32 count);
+// Pops up to max items into the array. Returns the number popped.
+u32 SpscPopN(SpscQueue *q, void *items, u32 max);
+// Same as SpscNew, for a queue that is safe to use from any number of threads.
+MpmcQueue MpmcNew(Arena *a, u32 itemSize, u32 cap);
+// Copies item into the queue. Returns false if full.
+bool MpmcPush(MpmcQueue *q, const void *item);
+// Copies the oldest item out of the queue. Returns false if empty.
+bool MpmcPop(MpmcQueue *q, void *item);
+// Pushes up to count items from the array as one consecutive run. Returns the number pushed.
+u32 MpmcPushN(MpmcQueue *q, const void *items, u32 count);
+// Pops up to max consecutive items into the array. Returns the number popped.
+u32 MpmcPopN(MpmcQueue *q, void *items, u32 max);
+
 //: doc_end
 
 #define List(T) T * // List type macro
@@ -169,6 +694,38 @@ void *ListPop(void *list);
 #define len(list) (ListLen(list))
 #define cap(list) (ListCap(list))
 #define pop(list) (ListPop(list))
+#define push(list, item) ((list) = ListPush(list, (u64)item))
+#define extend(list, items, count) ((list) = ListExtend(list, items, count))
+#define insertn(list, index, items, count) ((list) = ListInsertN(list, index, items, count))
+
+// Typed append and push, store the item by value with a plain assignment. Any
+// type works, including structs: appendv(points, (Point){1, 2}). A full list
+// goes through ListAppend, which sets ERR_LIST_FULL and counts it in XStats.
+#define listHeader(list) ((ListHeader *)(list)-1)
+#define _listGrowCap(list) (listHeader(list)->cap < 8 ? 8 : listHeader(list)->cap * 2)
+#define appendv(list, ...)                                                \
+    (listHeader(list)->length < listHeader(list)->cap                     \
+         ? (void)((list)[listHeader(list)->length++] = (__VA_ARGS__))     \
+         : ListAppend(list, 0))
+#define pushv(list, ...)                                                            \
+    ((void)(listHeader(list)->length == listHeader(list)->cap                       \
+                ? (void)((list) = ListReserve(list, _listGrowCap(list))) : (void)0), \
+     listHeader(list)->length < listHeader(list)->cap                               \
+         ? (void)((list)[listHeader(list)->length++] = (__VA_ARGS__))               \
+         : (void)0)
+
+#define map(T, arena, cap) MapNew(arena, sizeof(T), cap)
+#define mapget(m, T, key) ((T *)MapGet(&(m), key))
+#define mapput(m, T, key) ((T *)MapPut(&(m), key))
+
+// Default alignment of ArenaPush and ArenaPushArray
+#ifndef ARENA_ALIGN
+#define ARENA_ALIGN 16
+#endif
+
+#define _arenaAlignOf(T) (_Alignof(T) > ARENA_ALIGN ? _Alignof(T) : ARENA_ALIGN)
+#define ArenaPush(a, T) ((T *)ArenaAllocAligned(a, sizeof(T), _arenaAlignOf(T)))
+#define ArenaPushArray(a, T, n) ((T *)ArenaAllocAligned(a, sizeof(T) * (n), _arenaAlignOf(T)))
 
 //////////////////////////////////////////////////////////////////
 
@@ -176,13 +733,355 @@ void *ListPop(void *list);
 
 #ifdef LIBX
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
+
+// SSE2 is part of x86-64, AVX2 is checked for at runtime. Define LIBX_NO_SIMD
+// to only use the scalar fallbacks.
+#if !defined(LIBX_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#define LIBX_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define xtargetAVX2
+static inline u32 xctz(u32 x)
+{
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return index;
+}
+static inline u32 xctz64(u64 x)
+{
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return index;
+}
+#else
+#define xtargetAVX2 __attribute__((target("avx2")))
+#define xctz(x) ((u32)__builtin_ctz(x))
+#define xctz64(x) ((u32)__builtin_ctzll(x))
+#endif
+
+// Platform layer. Everything below uses these instead of calling the OS
+// directly, except for directory listing and asynchronous reads which have
+// a separate implementation per platform.
+#ifdef _WIN32
+
+#define PATH_SEPARATOR '\\'
 
 #define xdefaultAlloc(size) (HeapAlloc(GetProcessHeap(), 0, size))
 #define xdefaultFree(p) (HeapFree(GetProcessHeap(), 0, p))
+#define xdefaultRealloc(p, size) (HeapReAlloc(GetProcessHeap(), 0, p, size))
+
+#define xreserve(size) VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_READWRITE)
+#define xcommit(p, size) (VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE) != NULL)
+#define xdecommit(p, size) VirtualFree(p, size, MEM_DECOMMIT)
+#define xrelease(p, size) VirtualFree(p, 0, MEM_RELEASE)
+
+typedef HANDLE xthread;
+typedef SRWLOCK xmutex;
+typedef CONDITION_VARIABLE xcond;
+typedef DWORD xthreadResult;
+#define xthreadCall WINAPI
+
+static bool xthreadStart(xthread *t, xthreadResult(xthreadCall *func)(void *), void *arg)
+{
+    *t = CreateThread(NULL, 0, func, arg, 0, NULL);
+    return *t != NULL;
+}
+
+static void xthreadJoin(xthread t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+#define xmutexInit(m) InitializeSRWLock(m)
+#define xlock(m) AcquireSRWLockExclusive(m)
+#define xunlock(m) ReleaseSRWLockExclusive(m)
+#define xcondInit(c) InitializeConditionVariable(c)
+#define xcondWait(c, m) SleepConditionVariableSRW(c, m, INFINITE, 0)
+#define xcondWake(c) WakeConditionVariable(c)
+#define xcondWakeAll(c) WakeAllConditionVariable(c)
+#define xyield() SwitchToThread()
+
+static u32 xcpuCount(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+
+#ifdef LIBX_STATS
+// Monotonic time in microseconds, only needed for the stats counters
+static u64 xnowMicros(void)
+{
+    LARGE_INTEGER counter, freq;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&freq);
+    u64 c = counter.QuadPart, f = freq.QuadPart;
+    return c / f * 1000000 + c % f * 1000000 / f;
+}
+#endif
+
+#define xfileInvalid INVALID_HANDLE_VALUE
+#define xfileClose(file) CloseHandle(file)
+
+// Opens file for reading, hinting that it is read front to back
+static FileHandle xfileOpen(const char *path)
+{
+    return CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+}
+
+static bool xfileSize(FileHandle file, u64 *size)
+{
+    LARGE_INTEGER s;
+    if (!GetFileSizeEx(file, &s))
+        return false;
+    *size = s.QuadPart;
+    return true;
+}
+
+// Reads up to n bytes at the current position. Sets bytesRead to 0 at end of file.
+static bool xfileRead(FileHandle file, void *buffer, u32 n, u32 *bytesRead)
+{
+    DWORD done = 0;
+    bool ok = ReadFile(file, buffer, n, &done, NULL);
+    *bytesRead = done;
+    return ok;
+}
+
+static bool xfileWrite(FileHandle file, const void *data, u32 n, u32 *written)
+{
+    DWORD done = 0;
+    bool ok = WriteFile(file, data, n, &done, NULL);
+    *written = done;
+    return ok;
+}
+
+#else
+
+#define PATH_SEPARATOR '/'
+
+#define xdefaultAlloc(size) malloc(size)
+#define xdefaultFree(p) free(p)
+#define xdefaultRealloc(p, size) realloc(p, size)
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+// Reserved pages are inaccessible until committed, like MEM_RESERVE
+static void *xreserve(u64 size)
+{
+    void *p = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+#define xcommit(p, size) (mprotect(p, size, PROT_READ | PROT_WRITE) == 0)
+#define xdecommit(p, size) (madvise(p, size, MADV_DONTNEED), mprotect(p, size, PROT_NONE))
+#define xrelease(p, size) munmap(p, size)
+
+typedef pthread_t xthread;
+typedef pthread_mutex_t xmutex;
+typedef pthread_cond_t xcond;
+typedef void *xthreadResult;
+#define xthreadCall
+
+static bool xthreadStart(xthread *t, xthreadResult (*func)(void *), void *arg)
+{
+    return pthread_create(t, NULL, func, arg) == 0;
+}
+
+#define xthreadJoin(t) pthread_join(t, NULL)
+#define xmutexInit(m) pthread_mutex_init(m, NULL)
+#define xlock(m) pthread_mutex_lock(m)
+#define xunlock(m) pthread_mutex_unlock(m)
+#define xcondInit(c) pthread_cond_init(c, NULL)
+#define xcondWait(c, m) pthread_cond_wait(c, m)
+#define xcondWake(c) pthread_cond_signal(c)
+#define xcondWakeAll(c) pthread_cond_broadcast(c)
+#define xyield() sched_yield()
+
+static u32 xcpuCount(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+}
+
+#ifdef LIBX_STATS
+static u64 xnowMicros(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (u64)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+#endif
+
+#define xfileInvalid (-1)
+#define xfileClose(file) close(file)
+
+// posix_fadvise is missing on some systems, the hints are only
+// an optimization
+#ifdef POSIX_FADV_SEQUENTIAL
+#define xfileAdvise(file, offset, length, advice) posix_fadvise(file, offset, length, advice)
+#else
+#define xfileAdvise(file, offset, length, advice) ((void)0)
+#endif
+
+static FileHandle xfileOpen(const char *path)
+{
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file >= 0)
+        xfileAdvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return file;
+}
+
+// Directories open fine with open(), but are not readable files
+static bool xfileSize(FileHandle file, u64 *size)
+{
+    struct stat st;
+    if (fstat(file, &st) != 0 || S_ISDIR(st.st_mode))
+        return false;
+    *size = st.st_size;
+    return true;
+}
+
+static bool xfileRead(FileHandle file, void *buffer, u32 n, u32 *bytesRead)
+{
+    ssize_t done;
+    do
+        done = read(file, buffer, n);
+    while (done < 0 && errno == EINTR);
+    *bytesRead = done < 0 ? 0 : done;
+    return done >= 0;
+}
+
+static bool xfileWrite(FileHandle file, const void *data, u32 n, u32 *written)
+{
+    ssize_t done;
+    do
+        done = write(file, data, n);
+    while (done < 0 && errno == EINTR);
+    *written = done < 0 ? 0 : done;
+    return done >= 0;
+}
+
+#endif
+
+// Granularity virtual arenas commit and decommit memory in
+#ifndef ARENA_COMMIT_SIZE
+#define ARENA_COMMIT_SIZE (64 * 1024)
+#endif
+
+// Reserved size of each per-thread scratch arena
+#ifndef ARENA_SCRATCH_SIZE
+#define ARENA_SCRATCH_SIZE (64ull * 1024 * 1024)
+#endif
+
+#define ARENA_SCRATCH_COUNT 2
+
+#ifdef _MSC_VER
+#define xthreadlocal __declspec(thread)
+#else
+#define xthreadlocal __thread
+#endif
+
+// Read-modify-write operations are sequentially consistent and return the
+// previous value
+#ifdef _MSC_VER
+#define xatomicAdd64(p, v) ((u64)InterlockedExchangeAdd64((volatile LONG64 *)(p), (LONG64)(v)))
+#define xatomicCas64(p, old, new) ((u64)InterlockedCompareExchange64((volatile LONG64 *)(p), (LONG64)(new), (LONG64)(old)))
+#define xatomicStore64(p, v) ((void)InterlockedExchange64((volatile LONG64 *)(p), (LONG64)(v)))
+#else
+#define xatomicAdd64(p, v) __atomic_fetch_add((volatile u64 *)(p), (u64)(v), __ATOMIC_SEQ_CST)
+#define xatomicStore64(p, v) __atomic_store_n((volatile u64 *)(p), (u64)(v), __ATOMIC_SEQ_CST)
+static inline u64 xatomicCas64(volatile void *p, u64 old, u64 new)
+{
+    __atomic_compare_exchange_n((volatile u64 *)p, &old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return old;
+}
+#endif
+
+// Sequentially consistent load. Interlocked writes are full barriers, so on
+// x64 a plain load is enough.
+#if defined(_MSC_VER) && defined(_M_X64)
+#define xatomicLoad64(p) (*(volatile u64 *)(p))
+#elif defined(_MSC_VER)
+#define xatomicLoad64(p) ((u64)InterlockedOr64((volatile LONG64 *)(p), 0))
+#else
+#define xatomicLoad64(p) __atomic_load_n((volatile u64 *)(p), __ATOMIC_SEQ_CST)
+#endif
+
+// Plain loads and stores that keep the order of the memory accesses around
+// them, without a locked instruction on x86
+#ifdef _MSC_VER
+#define xloadAcquire64(p) (*(volatile u64 *)(p)) // Volatile has acquire and release semantics by default
+#define xstoreRelease64(p, v) (*(volatile u64 *)(p) = (v))
+#else
+#define xloadAcquire64(p) __atomic_load_n((volatile u64 *)(p), __ATOMIC_ACQUIRE)
+#define xstoreRelease64(p, v) __atomic_store_n((volatile u64 *)(p), (v), __ATOMIC_RELEASE)
+#endif
+
+#define CACHE_LINE_SIZE 64
+
+// Number of rotating buffers in a FileStream
+#ifndef STREAM_BUFFER_COUNT
+#define STREAM_BUFFER_COUNT 2
+#endif
+
+// Maximum number of reads in flight in XReadFilesEx
+#ifndef BATCH_MAX_INFLIGHT
+#define BATCH_MAX_INFLIGHT 64
+#endif
+
+// Maximum number of threads used by XWalkDir with WALK_PARALLEL
+#ifndef WALK_MAX_THREADS
+#define WALK_MAX_THREADS 16
+#endif
+
+// Jobs each worker queues before the rest go to the shared queue, power of two
+#ifndef JOB_QUEUE_SIZE
+#define JOB_QUEUE_SIZE 1024
+#endif
+
+// Maximum number of worker threads of a JobSystem
+#ifndef JOB_MAX_THREADS
+#define JOB_MAX_THREADS 64
+#endif
+
+#define alignUp(n, align) (((n) + ((align) - 1)) & ~((u64)(align) - 1))
+
+// Code only compiled with LIBX_STATS, eg. xstat(a->stats.allocs++)
+#ifdef LIBX_STATS
+#define xstat(x) x
+#ifdef _MSC_VER
+#define xreturnAddress() _ReturnAddress()
+#else
+#define xreturnAddress() __builtin_return_address(0)
+#endif
+static XStats globalStats;
+#else
+#define xstat(x)
+#endif
 
 void panic(char *msg)
 {
@@ -190,14 +1089,6 @@ void panic(char *msg)
     exit(1);
 }
 
-typedef struct ListHeader
-{
-    int length;
-    int cap;
-    int dataSize;
-    error err;
-} ListHeader;
-
 #define HEADER_SIZE (sizeof(ListHeader))
 
 static char *error_msgs[] = {
@@ -212,16 +1103,70 @@ static char *error_msgs[] = {
     [ERR_ITERATION_FINISH] = "Iterator is empty",
     [ERR_FILE_NOT_FOUND] = "File not found",
     [ERR_NULL_PTR] = "NULL pointer exception",
+    [ERR_ARENA_INVALID_MARK] = "Mark does not belong to arena",
+    [ERR_POOL_FOREIGN_PTR] = "Pointer does not belong to pool",
+    [ERR_ARENA_OWNED] = "Memory is owned by an arena",
+    [ERR_LIST_INDEX] = "List index out of range",
+    [ERR_FILE_WRITE] = "Failed to write to file",
+    [ERR_PARSE_INVALID] = "String is not a valid number",
+    [ERR_PARSE_OVERFLOW] = "Number out of range",
 };
 
 char *XError(error e)
 {
-    if (e > sizeof(error_msgs))
+    if (e >= sizeof(error_msgs) / sizeof(error_msgs[0]))
         panic("error out of bounds\n");
 
     return error_msgs[e];
 }
 
+// Header placed in front of each block of a growable arena
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *prev;
+    u64 size;
+    u64 prevPos; // Position in previous block when this block was linked
+} ArenaBlock;
+
+// Rounded up so block memory keeps the default allocators alignment
+#define BLOCK_HEADER_SIZE alignUp(sizeof(ArenaBlock), 16)
+
+static ArenaBlock *arenaNewBlock(u64 size, ArenaBlock *prev, u64 prevPos)
+{
+    ArenaBlock *block = xdefaultAlloc(BLOCK_HEADER_SIZE + size);
+    if (block == NULL)
+        return NULL;
+
+    block->prev = prev;
+    block->size = size;
+    block->prevPos = prevPos;
+    return block;
+}
+
+// Links a new block large enough for size bytes. Returns false if the
+// reserve limit is reached or the allocation fails.
+static bool arenaGrow(Arena *a, u64 size)
+{
+    u64 blockSize = a->block->size * 2;
+    if (blockSize < size)
+        blockSize = size;
+    if (a->reserved + blockSize > a->maxReserve)
+        blockSize = a->maxReserve - a->reserved;
+    if (blockSize < size)
+        return false;
+
+    ArenaBlock *block = arenaNewBlock(blockSize, a->block, a->pos);
+    if (block == NULL)
+        return false;
+
+    a->block = block;
+    a->memory = (char *)block + BLOCK_HEADER_SIZE;
+    a->size = blockSize;
+    a->pos = 0;
+    a->reserved += blockSize;
+    return true;
+}
+
 Arena ArenaNew(u64 size)
 {
     void *p = xdefaultAlloc(size);
@@ -237,481 +1182,5153 @@ Arena ArenaNew(u64 size)
     };
 }
 
-void *ArenaAlloc(Arena *a, u64 size)
+Arena ArenaNewGrowable(u64 initial, u64 maxReserve)
 {
-    if (a == NULL)
-        return NULL;
-    if (!Ok(*a))
-        return NULL;
+    if (initial == 0 || initial > maxReserve)
+        return (Arena){.err = ERR_NO_MEMORY};
 
-    if (a->pos + size > a->size)
-    {
-        a->err = ERR_NO_MEMORY;
-        return NULL;
-    }
+    ArenaBlock *block = arenaNewBlock(initial, NULL, 0);
+    if (block == NULL)
+        return (Arena){.err = ERR_NO_MEMORY};
 
-    void *p = a->memory + a->pos;
-    a->pos += size;
-    return p;
+    return (Arena){
+        .err = ERR_NO_ERROR,
+        .memory = (char *)block + BLOCK_HEADER_SIZE,
+        .pos = 0,
+        .size = initial,
+        .depth = 0,
+        .kind = ARENA_GROWABLE,
+        .block = block,
+        .reserved = initial,
+        .maxReserve = maxReserve,
+    };
 }
 
-Arena ArenaTemp(Arena *parent, u64 size)
+Arena ArenaNewVirtual(u64 reserve)
 {
-    if (parent == NULL)
-        return (Arena){.err = ERR_NULL_PTR};
-    if (!Ok(*parent))
-        (Arena){.err = parent->err};
-
-    void *p = ArenaAlloc(parent, size);
+    reserve = alignUp(reserve, ARENA_COMMIT_SIZE);
+    void *p = xreserve(reserve);
     if (p == NULL)
-        return (Arena){.err = parent->err};
+        return (Arena){.err = ERR_NO_MEMORY};
 
     return (Arena){
         .err = ERR_NO_ERROR,
         .memory = p,
         .pos = 0,
-        .size = size,
-        .depth = parent->depth + 1,
+        .size = reserve,
+        .depth = 0,
+        .kind = ARENA_VIRTUAL,
+        .committed = 0,
     };
 }
 
-error ArenaReleaseTemp(Arena *temp, Arena *parent)
+Arena ArenaNewShared(u64 reserve)
 {
-    if (temp == NULL || parent == NULL)
-        return ERR_NULL_PTR;
-    if (!Ok(*temp))
-        return temp->err;
-    if (!Ok(*parent))
-        return parent->err;
-
-    // If allocations have been made after creating the temp Arena
-    if (parent->memory + parent->pos - temp->size != temp->memory)
-        return ERR_ARENA_RELEASE_AFTER_ALLOC;
+    Arena a = ArenaNewVirtual(reserve);
+    if (Ok(a))
+        a.kind = ARENA_SHARED;
+    return a;
+}
 
-    parent->pos -= temp->size;
+// Bumps pos of a shared arena with a single atomic add. Pages are committed
+// by whichever thread first crosses the committed boundary. Committing an
+// already committed page is a no-op, so racing threads are harmless.
+static void *arenaAllocShared(Arena *a, u64 size, u64 align)
+{
+    u64 start = xatomicAdd64(&a->pos, size + align - 1);
+    u64 offset = alignUp((u64)a->memory + start, align) - (u64)a->memory;
+    u64 end = offset + size;
+    if (start + size + align - 1 > a->size)
+    {
+        a->err = ERR_NO_MEMORY;
+        return NULL;
+    }
+
+    u64 committed = xatomicLoad64(&a->committed);
+    if (end > committed)
+    {
+        u64 commit = alignUp(end, ARENA_COMMIT_SIZE);
+        if (commit > a->size)
+            commit = a->size;
+
+        if (!xcommit(a->memory + committed, commit - committed))
+        {
+            a->err = ERR_NO_MEMORY;
+            return NULL;
+        }
+
+        // Only ever move committed forward
+        while (committed < commit)
+        {
+            u64 prev = xatomicCas64(&a->committed, committed, commit);
+            if (prev == committed)
+                break;
+            committed = prev;
+        }
+    }
+
+    return a->memory + offset;
+}
+
+Arena ArenaChunk(Arena *shared, u64 size)
+{
+    if (shared == NULL)
+        return (Arena){.err = ERR_NULL_PTR};
+    if (!Ok(*shared))
+        return (Arena){.err = shared->err};
+
+    void *p = ArenaAllocAligned(shared, size, CACHE_LINE_SIZE);
+    if (p == NULL)
+        return (Arena){.err = shared->err};
+
+    return (Arena){
+        .err = ERR_NO_ERROR,
+        .memory = p,
+        .pos = 0,
+        .size = size,
+        .depth = shared->depth + 1,
+    };
+}
+
+// Commits pages of a virtual arena up to at least end.
+static bool arenaCommit(Arena *a, u64 end)
+{
+    u64 commit = alignUp(end, ARENA_COMMIT_SIZE);
+    if (commit > a->size)
+        commit = a->size;
+
+    if (!xcommit(a->memory + a->committed, commit - a->committed))
+        return false;
+
+    a->committed = commit;
+    return true;
+}
+
+#ifdef LIBX_STATS
+// Bytes in use, counting earlier blocks of a growable arena as full
+static u64 arenaUsed(Arena *a)
+{
+    return a->kind == ARENA_GROWABLE ? a->reserved - a->size + a->pos : a->pos;
+}
+
+static void arenaStatFail(Arena *a, void *site)
+{
+    a->stats.failures++;
+    a->stats.failSite = site;
+}
+#endif
+
+void *ArenaAlloc(Arena *a, u64 size)
+{
+    if (a == NULL)
+        return NULL;
+    if (!Ok(*a))
+        return NULL;
+    if (a->kind == ARENA_SHARED)
+    {
+        void *p = arenaAllocShared(a, size, 1);
+        xstat(xatomicAdd64(&a->stats.allocs, 1));
+        xstat(xatomicAdd64(&a->stats.bytes, size));
+        xstat(if (p == NULL) arenaStatFail(a, xreturnAddress()));
+        return p;
+    }
+
+    if (a->pos + size > a->size)
+    {
+        if (a->kind != ARENA_GROWABLE || !arenaGrow(a, size))
+        {
+            a->err = ERR_NO_MEMORY;
+            xstat(arenaStatFail(a, xreturnAddress()));
+            return NULL;
+        }
+    }
+
+    if (a->kind == ARENA_VIRTUAL && a->pos + size > a->committed && !arenaCommit(a, a->pos + size))
+    {
+        a->err = ERR_NO_MEMORY;
+        xstat(arenaStatFail(a, xreturnAddress()));
+        return NULL;
+    }
+
+    void *p = a->memory + a->pos;
+    a->pos += size;
+
+    xstat(a->stats.allocs++);
+    xstat(a->stats.bytes += size);
+    xstat(if (arenaUsed(a) > a->stats.peak) a->stats.peak = arenaUsed(a));
+    return p;
+}
+
+static u64 arenaPadding(Arena *a, u64 align)
+{
+    u64 addr = (u64)(a->memory + a->pos);
+    return alignUp(addr, align) - addr;
+}
+
+void *ArenaAllocAligned(Arena *a, u64 size, u64 align)
+{
+    if (a == NULL)
+        return NULL;
+    if (!Ok(*a))
+        return NULL;
+    if (a->kind == ARENA_SHARED)
+    {
+        void *p = arenaAllocShared(a, size, align);
+        xstat(xatomicAdd64(&a->stats.allocs, 1));
+        xstat(xatomicAdd64(&a->stats.bytes, size + align - 1));
+        xstat(if (p == NULL) arenaStatFail(a, xreturnAddress()));
+        return p;
+    }
+
+    u64 padding = arenaPadding(a, align);
+
+    // A new block has a different base address, so link it first and
+    // compute the padding from there
+    if (a->kind == ARENA_GROWABLE && a->pos + padding + size > a->size)
+    {
+        if (!arenaGrow(a, size + align - 1))
+        {
+            a->err = ERR_NO_MEMORY;
+            xstat(arenaStatFail(a, xreturnAddress()));
+            return NULL;
+        }
+        padding = arenaPadding(a, align);
+    }
+
+    char *p = ArenaAlloc(a, padding + size);
+    if (p == NULL)
+    {
+        // Report the caller instead of this function
+        xstat(a->stats.failSite = xreturnAddress());
+        return NULL;
+    }
+
+    return p + padding;
+}
+
+Arena ArenaTemp(Arena *parent, u64 size)
+{
+    if (parent == NULL)
+        return (Arena){.err = ERR_NULL_PTR};
+    if (!Ok(*parent))
+        return (Arena){.err = parent->err};
+
+    void *p = ArenaAlloc(parent, size);
+    if (p == NULL)
+        return (Arena){.err = parent->err};
+
+    return (Arena){
+        .err = ERR_NO_ERROR,
+        .memory = p,
+        .pos = 0,
+        .size = size,
+        .depth = parent->depth + 1,
+    };
+}
+
+error ArenaReleaseTemp(Arena *temp, Arena *parent)
+{
+    if (temp == NULL || parent == NULL)
+        return ERR_NULL_PTR;
+    if (!Ok(*temp))
+        return temp->err;
+    if (!Ok(*parent))
+        return parent->err;
+
+    // If allocations have been made after creating the temp Arena
+    if (parent->memory + parent->pos - temp->size != temp->memory)
+        return ERR_ARENA_RELEASE_AFTER_ALLOC;
+
+    parent->pos -= temp->size;
     temp->err = ERR_MEMORY_FREED;
     return ERR_NO_ERROR;
 }
 
-error ArenaFree(Arena *a)
+ArenaMark ArenaSave(Arena *a)
+{
+    if (a == NULL)
+        return (ArenaMark){0};
+
+    return (ArenaMark){
+        .block = a->block,
+        .pos = a->pos,
+    };
+}
+
+error ArenaRestore(Arena *a, ArenaMark mark)
 {
     if (a == NULL)
         return ERR_NULL_PTR;
-    if (a->err == ERR_MEMORY_FREED)
-        return ERR_DOUBLE_FREE;
-    if (!Ok(*a))
+    if (!Ok(*a) && a->err != ERR_NO_MEMORY)
         return a->err;
-    if (a->depth != 0)
-        return ERR_TEMP_ARENA_FREE;
 
-    xdefaultFree(a->memory);
-    a->err = ERR_MEMORY_FREED;
+    if (a->kind == ARENA_GROWABLE)
+    {
+        // Check the mark first so a bad one leaves the arena untouched
+        ArenaBlock *block = a->block;
+        while (block != NULL && block != mark.block)
+            block = block->prev;
+        if (block == NULL)
+            return ERR_ARENA_INVALID_MARK;
+
+        while (a->block != mark.block)
+        {
+            ArenaBlock *popped = a->block;
+            a->block = popped->prev;
+            a->pos = popped->prevPos;
+            a->reserved -= popped->size;
+            xdefaultFree(popped);
+        }
+
+        a->memory = (char *)a->block + BLOCK_HEADER_SIZE;
+        a->size = a->block->size;
+    }
+
+    if (mark.block != a->block || mark.pos > a->pos)
+        return ERR_ARENA_INVALID_MARK;
+
+    a->pos = mark.pos;
+    a->err = ERR_NO_ERROR;
     return ERR_NO_ERROR;
 }
 
-File XReadFile(const char *filepath)
+static xthreadlocal Arena scratchArenas[ARENA_SCRATCH_COUNT];
+
+Arena *ArenaScratch(Arena *conflict)
 {
-    if (filepath == NULL)
-        return (File){.err = ERR_NULL_PTR};
+    for (int i = 0; i < ARENA_SCRATCH_COUNT; i++)
+    {
+        Arena *scratch = &scratchArenas[i];
+        if (scratch == conflict)
+            continue;
 
-    File f = {0};
+        if (scratch->memory == NULL)
+            *scratch = ArenaNewVirtual(ARENA_SCRATCH_SIZE);
+        return scratch;
+    }
 
-    HANDLE file = CreateFileA(filepath, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (file == INVALID_HANDLE_VALUE)
-        goto return_error;
+    return NULL;
+}
 
-    DWORD bufSize = GetFileSize(file, NULL) + 1;
-    DWORD read;
-    char *buffer = xdefaultAlloc(bufSize);
-    if (!ReadFile(file, buffer, bufSize, &read, NULL))
+void ArenaFreeScratch(void)
+{
+    for (int i = 0; i < ARENA_SCRATCH_COUNT; i++)
     {
-        CloseHandle(file);
-        goto return_error;
+        if (scratchArenas[i].memory != NULL)
+            ArenaFree(&scratchArenas[i]);
+        scratchArenas[i] = (Arena){0};
+    }
+}
+
+error ArenaReset(Arena *a)
+{
+    if (a == NULL)
+        return ERR_NULL_PTR;
+    if (a->err == ERR_MEMORY_FREED)
+        return ERR_MEMORY_FREED;
+
+    if (a->kind == ARENA_GROWABLE)
+    {
+        while (a->block->prev != NULL)
+        {
+            ArenaBlock *prev = a->block->prev;
+            a->reserved -= a->block->size;
+            xdefaultFree(a->block);
+            a->block = prev;
+        }
+
+        a->memory = (char *)a->block + BLOCK_HEADER_SIZE;
+        a->size = a->block->size;
     }
 
-    CloseHandle(file);
-    buffer[bufSize - 1] = 0;
-    f.size = bufSize - 1;
-    f.data = buffer;
-    f.open = true;
-    strncpy(f.filepath, filepath, 260);
-    return f;
+    // Keep the first chunk committed so the next allocations dont fault
+    if ((a->kind == ARENA_VIRTUAL || a->kind == ARENA_SHARED) && a->committed > ARENA_COMMIT_SIZE)
+    {
+        xdecommit(a->memory + ARENA_COMMIT_SIZE, a->committed - ARENA_COMMIT_SIZE);
+        a->committed = ARENA_COMMIT_SIZE;
+    }
 
-return_error:
-    f.err = ERR_FILE_READ;
-    return f;
+    a->pos = 0;
+    a->err = ERR_NO_ERROR;
+    return ERR_NO_ERROR;
 }
 
-error XFreeFile(File *f)
+error ArenaFree(Arena *a)
 {
-    if (f == NULL)
+    if (a == NULL)
         return ERR_NULL_PTR;
-    if (f->err == ERR_MEMORY_FREED)
+    if (a->err == ERR_MEMORY_FREED)
         return ERR_DOUBLE_FREE;
-    if (!Ok(*f))
-        return f->err;
+    if (!Ok(*a))
+        return a->err;
+    if (a->depth != 0)
+        return ERR_TEMP_ARENA_FREE;
 
-    xdefaultFree(f->data);
-    f->err = ERR_MEMORY_FREED;
-    f->open = false;
+    if (a->kind == ARENA_GROWABLE)
+    {
+        ArenaBlock *block = a->block;
+        while (block != NULL)
+        {
+            ArenaBlock *prev = block->prev;
+            xdefaultFree(block);
+            block = prev;
+        }
+    }
+    else if (a->kind == ARENA_VIRTUAL || a->kind == ARENA_SHARED)
+        xrelease(a->memory, a->size);
+    else
+        xdefaultFree(a->memory);
+
+    a->err = ERR_MEMORY_FREED;
     return ERR_NO_ERROR;
 }
 
-FileIter XReadDir(const char *path)
+#ifdef LIBX_STATS
+ArenaStats ArenaGetStats(Arena *a)
 {
-    if (path == NULL)
-        return (FileIter){.err = ERR_NULL_PTR};
-
-    FileIter iter = {0};
+    if (a == NULL)
+        return (ArenaStats){0};
 
-    // FindFirstFile expects a * wildcard at end
-    char buf[512];
-    strcpy(buf, path);
-    strcat(buf, "\\*");
+    // Shared arenas only ever move pos forward, so it is the peak
+    ArenaStats stats = a->stats;
+    if (a->kind == ARENA_SHARED && a->pos > stats.peak)
+        stats.peak = a->pos < a->size ? a->pos : a->size;
+    return stats;
+}
 
-    HANDLE hFind = FindFirstFileA(buf, &iter.data);
-    if (hFind == INVALID_HANDLE_VALUE)
-        return (FileIter){.err = ERR_FILE_NOT_FOUND};
+XStats XGetStats(void)
+{
+    return (XStats){
+        .fileReads = xatomicLoad64(&globalStats.fileReads),
+        .fileBytes = xatomicLoad64(&globalStats.fileBytes),
+        .fileReadMicros = xatomicLoad64(&globalStats.fileReadMicros),
+        .listGrows = xatomicLoad64(&globalStats.listGrows),
+        .listFull = xatomicLoad64(&globalStats.listFull),
+    };
+}
 
-    iter.hFind = hFind;
-    return iter;
+void XResetStats(void)
+{
+    xatomicStore64(&globalStats.fileReads, 0);
+    xatomicStore64(&globalStats.fileBytes, 0);
+    xatomicStore64(&globalStats.fileReadMicros, 0);
+    xatomicStore64(&globalStats.listGrows, 0);
+    xatomicStore64(&globalStats.listFull, 0);
 }
+#endif
 
-File FileIterNext(FileIter *iter)
+Pool PoolNew(Arena *a, u64 objSize, u64 count)
 {
-    if (iter == NULL)
-        return (File){.err = ERR_NULL_PTR};
-    if (!Ok(*iter))
-        return (File){.err = iter->err};
+    if (a == NULL)
+        return (Pool){.err = ERR_NULL_PTR};
+    if (!Ok(*a))
+        return (Pool){.err = a->err};
 
-    File f = {0};
-    strcpy(f.filepath, iter->data.cFileName);
-    f.size = (u64)iter->data.nFileSizeLow | ((u64)iter->data.nFileSizeHigh << 32);
-    f.isDir = iter->data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
-    f.readOnly = iter->data.dwFileAttributes & FILE_ATTRIBUTE_READONLY;
+    u64 slotSize = alignUp(objSize < sizeof(void *) ? sizeof(void *) : objSize, sizeof(void *));
+    void *memory = ArenaAllocAligned(a, slotSize * count, ARENA_ALIGN);
+    if (memory == NULL)
+        return (Pool){.err = a->err};
 
-    if (!FindNextFileA(iter->hFind, &iter->data))
+    return (Pool){
+        .err = ERR_NO_ERROR,
+        .memory = memory,
+        .free = NULL,
+        .slotSize = slotSize,
+        .count = count,
+        .used = 0,
+    };
+}
+
+void *PoolAlloc(Pool *p)
+{
+    if (p == NULL)
+        return NULL;
+    if (!Ok(*p))
+        return NULL;
+
+    if (p->free != NULL)
     {
-        iter->err = ERR_ITERATION_FINISH;
-        FindClose(iter->hFind);
+        void *obj = p->free;
+        p->free = *(void **)obj;
+        return obj;
     }
 
-    return f;
+    // Hand out untouched slots in order instead of linking them all up front
+    if (p->used < p->count)
+        return (char *)p->memory + (p->used++ * p->slotSize);
+
+    return NULL;
 }
 
-error XCloseFileIter(FileIter *iter)
+error PoolFree(Pool *p, void *obj)
 {
-    if (iter == NULL)
+    if (p == NULL || obj == NULL)
         return ERR_NULL_PTR;
-    if (!Ok(*iter))
-        return iter->err;
-    FindClose(iter->hFind);
-    iter->err = ERR_ITERATION_FINISH;
+    if (!Ok(*p))
+        return p->err;
+
+    u64 offset = (char *)obj - (char *)p->memory;
+    if ((char *)obj < (char *)p->memory || offset >= p->used * p->slotSize || offset % p->slotSize != 0)
+        return ERR_POOL_FOREIGN_PTR;
+
+    *(void **)obj = p->free;
+    p->free = obj;
     return ERR_NO_ERROR;
 }
 
-static ListHeader *getHeader(void *ptr)
-{
-    return (ListHeader *)(ptr - HEADER_SIZE);
+// ReadFile takes a DWORD size, so large files are read in several calls
+#define READ_CHUNK_SIZE (1u << 30)
+
+#ifdef LIBX_STATS
+static void statFileRead(u64 bytes, u64 start)
+{
+    xatomicAdd64(&globalStats.fileReads, 1);
+    xatomicAdd64(&globalStats.fileBytes, bytes);
+    xatomicAdd64(&globalStats.fileReadMicros, xnowMicros() - start);
+}
+#endif
+
+// Reads an open file into memory from the arena, or the default allocator if
+// a is NULL, and closes it.
+static error readOpenFile(Arena *a, FileHandle file, File *f)
+{
+    u64 size;
+    if (!xfileSize(file, &size))
+    {
+        xfileClose(file);
+        return ERR_FILE_READ;
+    }
+
+    u64 bufSize = size + 1;
+    char *buffer = a == NULL ? xdefaultAlloc(bufSize) : ArenaAlloc(a, bufSize);
+    if (buffer == NULL)
+    {
+        xfileClose(file);
+        return ERR_NO_MEMORY;
+    }
+
+    u64 total = 0;
+    while (total < bufSize - 1)
+    {
+        u64 left = bufSize - 1 - total;
+        u32 read;
+        if (!xfileRead(file, buffer + total, left < READ_CHUNK_SIZE ? left : READ_CHUNK_SIZE, &read) || read == 0)
+        {
+            // Arena memory is reclaimed with the arena
+            if (a == NULL)
+                xdefaultFree(buffer);
+            xfileClose(file);
+            return ERR_FILE_READ;
+        }
+        total += read;
+    }
+
+    xfileClose(file);
+    buffer[total] = 0;
+    f->size = total;
+    f->data = buffer;
+    f->open = true;
+    f->inArena = a != NULL;
+    return ERR_NO_ERROR;
+}
+
+// Reads file into memory from the arena, or the default allocator if a is NULL.
+static File readFile(Arena *a, const char *filepath)
+{
+    if (filepath == NULL)
+        return (File){.err = ERR_NULL_PTR};
+
+    File f = {0};
+    xstat(u64 start = xnowMicros());
+
+    FileHandle file = xfileOpen(filepath);
+    if (file == xfileInvalid)
+        return (File){.err = ERR_FILE_READ};
+
+    f.err = readOpenFile(a, file, &f);
+    if (!Ok(f))
+        return f;
+
+    strncpy(f.filepath, filepath, sizeof(f.filepath) - 1);
+    f.filepath[sizeof(f.filepath) - 1] = 0;
+    xstat(statFileRead(f.size, start));
+    return f;
+}
+
+File XReadFile(const char *filepath)
+{
+    return readFile(NULL, filepath);
+}
+
+File XReadFileArena(Arena *a, const char *filepath)
+{
+    if (a == NULL)
+        return (File){.err = ERR_NULL_PTR};
+    if (!Ok(*a))
+        return (File){.err = a->err};
+
+    return readFile(a, filepath);
+}
+
+error XFreeFile(File *f)
+{
+    if (f == NULL)
+        return ERR_NULL_PTR;
+    if (f->err == ERR_MEMORY_FREED)
+        return ERR_DOUBLE_FREE;
+    if (!Ok(*f))
+        return f->err;
+    if (f->mapped)
+        return XUnmapFile(f);
+    if (f->inArena)
+        return ERR_ARENA_OWNED;
+
+    xdefaultFree(f->data);
+    f->err = ERR_MEMORY_FREED;
+    f->open = false;
+    return ERR_NO_ERROR;
+}
+
+File XMapFile(const char *filepath)
+{
+    if (filepath == NULL)
+        return (File){.err = ERR_NULL_PTR};
+
+    File f = {0};
+
+    FileHandle file = xfileOpen(filepath);
+    if (file == xfileInvalid)
+        goto return_error;
+
+    u64 size;
+    if (!xfileSize(file, &size))
+    {
+        xfileClose(file);
+        goto return_error;
+    }
+
+    // Empty files cannot be mapped
+    static char empty[1] = {0};
+    char *view = empty;
+    if (size > 0)
+    {
+#ifdef _WIN32
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL)
+        {
+            CloseHandle(file);
+            goto return_error;
+        }
+
+        // The view keeps the mapping alive after both handles are closed
+        view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+#else
+        // The mapping stays valid after the file is closed
+        view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (view == MAP_FAILED)
+            view = NULL;
+        else
+            madvise(view, size, MADV_SEQUENTIAL);
+#endif
+    }
+
+    xfileClose(file);
+    if (view == NULL)
+        goto return_error;
+
+    f.size = size;
+    f.data = view;
+    f.open = true;
+    f.mapped = true;
+    strncpy(f.filepath, filepath, sizeof(f.filepath) - 1);
+    f.filepath[sizeof(f.filepath) - 1] = 0;
+    return f;
+
+return_error:
+    f.err = ERR_FILE_READ;
+    return f;
+}
+
+error XUnmapFile(File *f)
+{
+    if (f == NULL)
+        return ERR_NULL_PTR;
+    if (f->err == ERR_MEMORY_FREED)
+        return ERR_DOUBLE_FREE;
+    if (!Ok(*f))
+        return f->err;
+    if (!f->mapped)
+        return XFreeFile(f);
+
+    if (f->size > 0)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(f->data);
+#else
+        munmap(f->data, f->size);
+#endif
+    }
+    f->err = ERR_MEMORY_FREED;
+    f->open = false;
+    return ERR_NO_ERROR;
+}
+
+typedef struct StreamBuffer
+{
+#ifdef _WIN32
+    OVERLAPPED ov;
+#endif
+    char *data;   // chunkSize bytes for the carried line, then chunkSize bytes read from file
+    u64 offset;   // File offset of data read into this buffer
+    u32 read;
+    u32 want;     // Size of the issued read
+    bool pending; // Read is issued and not yet waited for
+    bool failed;
+} StreamBuffer;
+
+// Issues read of the next chunk into buf. Does nothing at end of file.
+static void streamRead(FileStream *s, StreamBuffer *buf)
+{
+    buf->offset = s->offset;
+    buf->read = 0;
+    buf->pending = false;
+    buf->failed = false;
+
+    if (s->offset >= s->size)
+        return;
+
+    u64 left = s->size - s->offset;
+    u32 n = left < s->chunkSize ? left : s->chunkSize;
+    buf->want = n;
+    s->offset += n;
+
+#ifdef _WIN32
+    buf->ov.Offset = (DWORD)buf->offset;
+    buf->ov.OffsetHigh = (DWORD)(buf->offset >> 32);
+
+    // Synchronous completions still signal the event, so both cases are waited for
+    if (ReadFile(s->file, buf->data + s->chunkSize, n, NULL, &buf->ov) || GetLastError() == ERROR_IO_PENDING)
+        buf->pending = true;
+    else
+        buf->failed = true;
+#else
+    // The kernel reads the range in the background, the copy into the
+    // buffer happens when the chunk is waited for
+    xfileAdvise(s->file, buf->offset, n, POSIX_FADV_WILLNEED);
+    buf->pending = true;
+#endif
+}
+
+// Waits for the read issued into buf. Reads stop early at end of file.
+static void streamWait(FileStream *s, StreamBuffer *buf)
+{
+    buf->pending = false;
+
+#ifdef _WIN32
+    DWORD read = 0;
+    if (!GetOverlappedResult(s->file, &buf->ov, &read, TRUE) && GetLastError() != ERROR_HANDLE_EOF)
+        buf->failed = true;
+    buf->read = read;
+#else
+    char *data = buf->data + s->chunkSize;
+    while (buf->read < buf->want)
+    {
+        ssize_t n = pread(s->file, data + buf->read, buf->want - buf->read, buf->offset + buf->read);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            buf->failed = n < 0;
+            break;
+        }
+        buf->read += n;
+    }
+#endif
+}
+
+FileStream XOpenStream(const char *filepath, u32 chunkSize)
+{
+    if (filepath == NULL)
+        return (FileStream){.err = ERR_NULL_PTR};
+    if (chunkSize == 0)
+        return (FileStream){.err = ERR_NO_MEMORY};
+
+    FileStream s = {0};
+
+#ifdef _WIN32
+    s.file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+#else
+    s.file = xfileOpen(filepath);
+#endif
+    if (s.file == xfileInvalid)
+        return (FileStream){.err = ERR_FILE_READ};
+
+    u64 size;
+    if (!xfileSize(s.file, &size))
+    {
+        xfileClose(s.file);
+        return (FileStream){.err = ERR_FILE_READ};
+    }
+
+    // Buffers live on the heap so pending reads survive the stream being moved
+    u64 headerSize = alignUp(sizeof(StreamBuffer) * STREAM_BUFFER_COUNT, 16);
+    char *memory = xdefaultAlloc(headerSize + (u64)chunkSize * 2 * STREAM_BUFFER_COUNT);
+    if (memory == NULL)
+    {
+        xfileClose(s.file);
+        return (FileStream){.err = ERR_NO_MEMORY};
+    }
+
+    s.buffers = (StreamBuffer *)memory;
+    s.size = size;
+    s.chunkSize = chunkSize;
+
+    for (int i = 0; i < STREAM_BUFFER_COUNT; i++)
+    {
+        StreamBuffer *buf = &s.buffers[i];
+        *buf = (StreamBuffer){0};
+        buf->data = memory + headerSize + (u64)chunkSize * 2 * i;
+#ifdef _WIN32
+        buf->ov.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if (buf->ov.hEvent == NULL)
+        {
+            while (i-- > 0)
+                CloseHandle(s.buffers[i].ov.hEvent);
+            xdefaultFree(memory);
+            xfileClose(s.file);
+            return (FileStream){.err = ERR_NO_MEMORY};
+        }
+#endif
+    }
+
+    for (int i = 0; i < STREAM_BUFFER_COUNT; i++)
+        streamRead(&s, &s.buffers[i]);
+
+    return s;
+}
+
+String FileStreamNext(FileStream *s)
+{
+    if (s == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    if (!Ok(*s))
+        return (String){.err = s->err};
+
+    StreamBuffer *buf = &s->buffers[s->next];
+    if (buf->pending)
+        streamWait(s, buf);
+
+    if (buf->failed)
+    {
+        s->err = ERR_FILE_READ;
+        return (String){.err = s->err};
+    }
+
+    char *chunk = buf->data + s->chunkSize;
+
+    // Move the unfinished line in front of this chunk, then reuse the
+    // previous buffer for the next read
+    if (s->started)
+    {
+        u32 prevIndex = (s->next + STREAM_BUFFER_COUNT - 1) % STREAM_BUFFER_COUNT;
+        StreamBuffer *prev = &s->buffers[prevIndex];
+        char *prevEnd = prev->data + s->chunkSize + prev->read;
+
+        memcpy(chunk - s->carry, prevEnd - s->carry, s->carry);
+        streamRead(s, prev);
+    }
+
+    s->started = true;
+    s->next = (s->next + 1) % STREAM_BUFFER_COUNT;
+
+    char *start = chunk - s->carry;
+    u32 length = s->carry + buf->read;
+    s->carry = 0;
+
+    if (buf->offset + buf->read >= s->size)
+    {
+        // Drop the newline ending the file, like the ones between chunks
+        if (length > 0 && start[length - 1] == '\n')
+            length--;
+        s->err = ERR_ITERATION_FINISH;
+        return (String){.err = ERR_NO_ERROR, .str = start, .length = length};
+    }
+
+    // Split after the last newline, unless the remaining line does not fit
+    // in front of the next chunk
+    for (u32 i = length; i > 0; i--)
+    {
+        if (start[i - 1] == '\n')
+        {
+            u32 tail = length - i;
+            if (tail <= s->chunkSize)
+            {
+                s->carry = tail;
+                length = i - 1;
+            }
+            break;
+        }
+    }
+
+    return (String){.err = ERR_NO_ERROR, .str = start, .length = length};
+}
+
+error XCloseStream(FileStream *s)
+{
+    if (s == NULL)
+        return ERR_NULL_PTR;
+    if (s->buffers == NULL)
+        return ERR_DOUBLE_FREE;
+
+#ifdef _WIN32
+    CancelIo(s->file);
+    for (int i = 0; i < STREAM_BUFFER_COUNT; i++)
+    {
+        StreamBuffer *buf = &s->buffers[i];
+        DWORD read;
+        if (buf->pending)
+            GetOverlappedResult(s->file, &buf->ov, &read, TRUE);
+        CloseHandle(buf->ov.hEvent);
+    }
+#endif
+
+    xfileClose(s->file);
+    xdefaultFree(s->buffers);
+    s->buffers = NULL;
+    s->err = ERR_MEMORY_FREED;
+    return ERR_NO_ERROR;
+}
+
+#ifdef _WIN32
+
+FileIter XReadDir(const char *path)
+{
+    if (path == NULL)
+        return (FileIter){.err = ERR_NULL_PTR};
+
+    FileIter iter = {0};
+
+    // FindFirstFile expects a * wildcard at end
+    char buf[512];
+    strcpy(buf, path);
+    strcat(buf, "\\*");
+
+    HANDLE hFind = FindFirstFileA(buf, &iter.data);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return (FileIter){.err = ERR_FILE_NOT_FOUND};
+
+    iter.hFind = hFind;
+    return iter;
+}
+
+File FileIterNext(FileIter *iter)
+{
+    if (iter == NULL)
+        return (File){.err = ERR_NULL_PTR};
+    if (!Ok(*iter))
+        return (File){.err = iter->err};
+
+    File f = {0};
+    strcpy(f.filepath, iter->data.cFileName);
+    f.size = (u64)iter->data.nFileSizeLow | ((u64)iter->data.nFileSizeHigh << 32);
+    f.isDir = iter->data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+    f.readOnly = iter->data.dwFileAttributes & FILE_ATTRIBUTE_READONLY;
+
+    if (!FindNextFileA(iter->hFind, &iter->data))
+    {
+        iter->err = ERR_ITERATION_FINISH;
+        FindClose(iter->hFind);
+    }
+
+    return f;
+}
+
+error XCloseFileIter(FileIter *iter)
+{
+    if (iter == NULL)
+        return ERR_NULL_PTR;
+    if (!Ok(*iter))
+        return iter->err;
+    FindClose(iter->hFind);
+    iter->err = ERR_ITERATION_FINISH;
+    return ERR_NO_ERROR;
+}
+
+#else
+
+// Reads the first entry right away, like FindFirstFile, so an iterator is
+// only ok while there is an entry left
+FileIter XReadDir(const char *path)
+{
+    if (path == NULL)
+        return (FileIter){.err = ERR_NULL_PTR};
+
+    FileIter iter = {0};
+    iter.dir = opendir(path);
+    if (iter.dir == NULL)
+        return (FileIter){.err = ERR_FILE_NOT_FOUND};
+
+    iter.entry = readdir(iter.dir);
+    if (iter.entry == NULL)
+    {
+        closedir(iter.dir);
+        return (FileIter){.err = ERR_FILE_NOT_FOUND};
+    }
+    return iter;
+}
+
+File FileIterNext(FileIter *iter)
+{
+    if (iter == NULL)
+        return (File){.err = ERR_NULL_PTR};
+    if (!Ok(*iter))
+        return (File){.err = iter->err};
+
+    File f = {0};
+    strncpy(f.filepath, iter->entry->d_name, sizeof(f.filepath) - 1);
+
+    struct stat st;
+    if (fstatat(dirfd(iter->dir), f.filepath, &st, 0) == 0)
+    {
+        f.size = st.st_size;
+        f.isDir = S_ISDIR(st.st_mode);
+        f.readOnly = (st.st_mode & 0222) == 0;
+    }
+
+    iter->entry = readdir(iter->dir);
+    if (iter->entry == NULL)
+    {
+        iter->err = ERR_ITERATION_FINISH;
+        closedir(iter->dir);
+    }
+
+    return f;
+}
+
+error XCloseFileIter(FileIter *iter)
+{
+    if (iter == NULL)
+        return ERR_NULL_PTR;
+    if (!Ok(*iter))
+        return iter->err;
+    closedir(iter->dir);
+    iter->err = ERR_ITERATION_FINISH;
+    return ERR_NO_ERROR;
+}
+
+#endif
+
+static ListHeader *getHeader(void *ptr)
+{
+    return (ListHeader *)(ptr - HEADER_SIZE);
+}
+
+void *ListCreate(size_t dataSize, size_t length)
+{
+    ListHeader header = {
+        .length = 0,
+        .cap = length,
+        .dataSize = dataSize,
+        .arena = NULL,
+    };
+
+    void *listptr = xdefaultAlloc(HEADER_SIZE + (dataSize * length));
+    if (listptr == NULL)
+        return NULL;
+
+    memcpy(listptr, &header, HEADER_SIZE);
+    return (listptr + HEADER_SIZE);
+}
+
+void *ListCreateArena(Arena *a, size_t dataSize, size_t length)
+{
+    if (a == NULL || !Ok(*a))
+        return NULL;
+
+    ListHeader *header = ArenaAllocAligned(a, HEADER_SIZE + dataSize * length, ARENA_ALIGN);
+    if (header == NULL)
+        return NULL;
+
+    *header = (ListHeader){
+        .length = 0,
+        .cap = length,
+        .dataSize = dataSize,
+        .arena = a,
+    };
+    return (char *)header + HEADER_SIZE;
+}
+
+int ListLen(void *list)
+{
+    return getHeader(list)->length;
+}
+
+int ListCap(void *list)
+{
+    return getHeader(list)->cap;
+}
+
+error ListErr(void *list)
+{
+    if (list == NULL)
+        return ERR_NULL_PTR;
+    return getHeader(list)->err;
+}
+
+void ListAppend(void *list, u64 item)
+{
+    ListHeader *header = getHeader(list);
+    int size = header->dataSize;
+
+    if (header->length < header->cap)
+    {
+        int length = (header->length * size);
+
+        if (size > sizeof(u64))
+            memcpy(list + length, (void *)item, size);
+        else
+            memcpy(list + length, &item, size);
+
+        header->length++;
+    }
+    else
+    {
+        header->err = ERR_LIST_FULL;
+        xstat(xatomicAdd64(&globalStats.listFull, 1));
+    }
+}
+
+void *ListPop(void *list)
+{
+    ListHeader *header = getHeader(list);
+    header->length--;
+    return list + (header->length * header->dataSize);
+}
+
+void ListFree(void *list)
+{
+    // Arena lists are freed with their arena
+    if (list != NULL && getHeader(list)->arena == NULL)
+        xdefaultFree(getHeader(list));
+}
+
+// Extends the allocation ending at end by size bytes, only if it is the last
+// allocation in the arena and the arena has room without linking a new block.
+static bool arenaExtend(Arena *a, void *end, u64 size)
+{
+    if (!Ok(*a) || a->kind == ARENA_SHARED)
+        return false;
+    if ((char *)a->memory + a->pos != end || a->pos + size > a->size)
+        return false;
+    return ArenaAlloc(a, size) == end;
+}
+
+void *ListReserve(void *list, size_t cap)
+{
+    if (list == NULL)
+        return NULL;
+
+    ListHeader *header = getHeader(list);
+    if (cap <= header->cap)
+        return list;
+
+    u64 oldSize = HEADER_SIZE + (u64)header->dataSize * header->cap;
+    u64 newSize = HEADER_SIZE + (u64)header->dataSize * cap;
+    Arena *a = header->arena;
+
+    if (a == NULL)
+    {
+        ListHeader *grown = xdefaultRealloc(header, newSize);
+        if (grown == NULL)
+        {
+            header->err = ERR_NO_MEMORY;
+            return list;
+        }
+        header = grown;
+    }
+    else if (!arenaExtend(a, (char *)header + oldSize, newSize - oldSize))
+    {
+        // The old list stays in the arena until it is freed
+        ListHeader *grown = ArenaAllocAligned(a, newSize, ARENA_ALIGN);
+        if (grown == NULL)
+        {
+            header->err = ERR_NO_MEMORY;
+            return list;
+        }
+        memcpy(grown, header, oldSize);
+        header = grown;
+    }
+
+    header->cap = cap;
+    xstat(xatomicAdd64(&globalStats.listGrows, 1));
+    return (char *)header + HEADER_SIZE;
+}
+
+void *ListShrink(void *list)
+{
+    if (list == NULL)
+        return NULL;
+
+    ListHeader *header = getHeader(list);
+    u64 oldSize = HEADER_SIZE + (u64)header->dataSize * header->cap;
+    u64 newSize = HEADER_SIZE + (u64)header->dataSize * header->length;
+    Arena *a = header->arena;
+
+    if (a == NULL)
+    {
+        ListHeader *shrunk = xdefaultRealloc(header, newSize);
+        if (shrunk == NULL)
+            return list;
+        header = shrunk;
+    }
+    else if (Ok(*a) && a->kind != ARENA_SHARED && (char *)a->memory + a->pos == (char *)header + oldSize)
+        a->pos -= oldSize - newSize;
+    else
+        return list;
+
+    header->cap = header->length;
+    return (char *)header + HEADER_SIZE;
+}
+
+// Grows list to fit count more items, at least doubling its capacity.
+static void *listFit(void *list, u64 count)
+{
+    ListHeader *header = getHeader(list);
+    u64 need = (u64)header->length + count;
+    if (need <= header->cap)
+        return list;
+
+    u64 cap = _listGrowCap(list);
+    return ListReserve(list, need > cap ? need : cap);
+}
+
+void *ListPush(void *list, u64 item)
+{
+    if (list == NULL)
+        return NULL;
+
+    // A failed grow leaves ERR_NO_MEMORY set instead of ERR_LIST_FULL
+    list = listFit(list, 1);
+    if (getHeader(list)->length < getHeader(list)->cap)
+        ListAppend(list, item);
+    return list;
+}
+
+void *ListExtend(void *list, const void *items, size_t count)
+{
+    return ListInsertN(list, list == NULL ? 0 : getHeader(list)->length, items, count);
+}
+
+void *ListInsertN(void *list, size_t index, const void *items, size_t count)
+{
+    if (list == NULL)
+        return NULL;
+
+    ListHeader *header = getHeader(list);
+    if (items == NULL && count > 0)
+    {
+        header->err = ERR_NULL_PTR;
+        return list;
+    }
+    if (index > header->length)
+    {
+        header->err = ERR_LIST_INDEX;
+        return list;
+    }
+
+    list = listFit(list, count);
+    header = getHeader(list);
+    if (header->length + count > header->cap)
+        return list;
+
+    u64 size = header->dataSize;
+    char *at = (char *)list + index * size;
+    memmove(at + count * size, at, (header->length - index) * size);
+    memcpy(at, items, count * size);
+    header->length += count;
+    return list;
+}
+
+#ifdef _WIN32
+
+typedef struct BatchRead
+{
+    OVERLAPPED ov; // First so completions map back to the read
+    HANDLE file;
+    File f;
+    u64 done; // Bytes read so far
+    u32 index;
+    bool reading; // Read is issued and its completion not yet dequeued
+} BatchRead;
+
+// Issues read of the rest of the file, in chunks ReadFile can handle.
+static bool batchIssueRead(BatchRead *r)
+{
+    u64 done = r->done;
+    u64 left = r->f.size - done;
+    DWORD n = left < READ_CHUNK_SIZE ? left : READ_CHUNK_SIZE;
+
+    r->ov = (OVERLAPPED){0};
+    r->ov.Offset = (DWORD)done;
+    r->ov.OffsetHigh = (DWORD)(done >> 32);
+
+    // Synchronous completions are still queued on the port
+    r->reading = ReadFile(r->file, r->f.data + done, n, NULL, &r->ov) || GetLastError() == ERROR_IO_PENDING;
+    return r->reading;
+}
+
+static void batchFinish(BatchRead *r, error err, FileCallback cb, void *ctx)
+{
+    if (r->file != INVALID_HANDLE_VALUE)
+        CloseHandle(r->file);
+
+    r->f.err = err;
+    r->f.open = err == ERR_NO_ERROR;
+    if (r->f.open)
+        r->f.data[r->f.size] = 0;
+
+    cb(&r->f, r->index, ctx);
+}
+
+// Opens file and issues its first read. Returns false if the file finished
+// right away, in which case cb has already been called.
+static bool batchStart(Arena *a, HANDLE port, BatchRead *r, const char *path, u32 index, FileCallback cb, void *ctx)
+{
+    *r = (BatchRead){.index = index};
+    if (path == NULL)
+    {
+        r->file = INVALID_HANDLE_VALUE;
+        batchFinish(r, ERR_NULL_PTR, cb, ctx);
+        return false;
+    }
+
+    strncpy(r->f.filepath, path, sizeof(r->f.filepath) - 1);
+    r->f.filepath[sizeof(r->f.filepath) - 1] = 0;
+    r->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (r->file == INVALID_HANDLE_VALUE)
+    {
+        batchFinish(r, ERR_FILE_READ, cb, ctx);
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(r->file, &size) || CreateIoCompletionPort(r->file, port, 0, 0) == NULL)
+    {
+        batchFinish(r, ERR_FILE_READ, cb, ctx);
+        return false;
+    }
+
+    r->f.size = size.QuadPart;
+    r->f.data = ArenaAlloc(a, r->f.size + 1);
+    r->f.inArena = true;
+    if (r->f.data == NULL)
+    {
+        batchFinish(r, ERR_NO_MEMORY, cb, ctx);
+        return false;
+    }
+
+    if (r->f.size == 0)
+    {
+        batchFinish(r, ERR_NO_ERROR, cb, ctx);
+        return false;
+    }
+
+    if (!batchIssueRead(r))
+    {
+        batchFinish(r, ERR_FILE_READ, cb, ctx);
+        return false;
+    }
+
+    return true;
+}
+
+error XReadFilesEx(Arena *a, const char **paths, u32 count, FileCallback cb, void *ctx)
+{
+    if (a == NULL || paths == NULL || cb == NULL)
+        return ERR_NULL_PTR;
+    if (!Ok(*a))
+        return a->err;
+
+    HANDLE port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (port == NULL)
+        return ERR_FILE_READ;
+
+    BatchRead *reads = xdefaultAlloc(sizeof(BatchRead) * BATCH_MAX_INFLIGHT);
+    if (reads == NULL)
+    {
+        CloseHandle(port);
+        return ERR_NO_MEMORY;
+    }
+
+    // Stack of unused read slots
+    BatchRead *slots[BATCH_MAX_INFLIGHT];
+    u32 idle = BATCH_MAX_INFLIGHT;
+    for (u32 i = 0; i < BATCH_MAX_INFLIGHT; i++)
+    {
+        reads[i] = (BatchRead){0};
+        slots[i] = &reads[i];
+    }
+
+    u32 next = 0;
+    while (next < count || idle < BATCH_MAX_INFLIGHT)
+    {
+        while (next < count && idle > 0)
+        {
+            if (batchStart(a, port, slots[idle - 1], paths[next], next, cb, ctx))
+                idle--;
+            next++;
+        }
+
+        if (idle == BATCH_MAX_INFLIGHT)
+            continue;
+
+        DWORD n;
+        ULONG_PTR key;
+        OVERLAPPED *ov;
+        BOOL ok = GetQueuedCompletionStatus(port, &n, &key, &ov, INFINITE);
+        if (ov == NULL)
+            break;
+
+        BatchRead *r = (BatchRead *)ov;
+        r->reading = false;
+        r->done += n;
+
+        if (ok && n > 0 && r->done < r->f.size && batchIssueRead(r))
+            continue;
+
+        batchFinish(r, ok && r->done == r->f.size ? ERR_NO_ERROR : ERR_FILE_READ, cb, ctx);
+        slots[idle++] = r;
+    }
+
+    // The loop only stops early if the port fails. Reads in flight are
+    // cancelled and waited for before their slots are freed, and files not
+    // started yet fail too, so every file still gets its callback.
+    for (u32 i = 0; i < BATCH_MAX_INFLIGHT; i++)
+    {
+        BatchRead *r = &reads[i];
+        if (!r->reading)
+            continue;
+
+        DWORD n;
+        CancelIo(r->file);
+        GetOverlappedResult(r->file, &r->ov, &n, TRUE);
+        batchFinish(r, ERR_FILE_READ, cb, ctx);
+    }
+
+    for (; next < count; next++)
+    {
+        BatchRead r = {.file = INVALID_HANDLE_VALUE, .index = next};
+        if (paths[next] != NULL)
+        {
+            strncpy(r.f.filepath, paths[next], sizeof(r.f.filepath) - 1);
+            r.f.filepath[sizeof(r.f.filepath) - 1] = 0;
+        }
+        batchFinish(&r, paths[next] == NULL ? ERR_NULL_PTR : ERR_FILE_READ, cb, ctx);
+    }
+
+    xdefaultFree(reads);
+    CloseHandle(port);
+    return ERR_NO_ERROR;
+}
+
+#else
+
+// Without overlapped reads the files are opened up to BATCH_MAX_INFLIGHT
+// ahead of the one being read, with a hint so the kernel fetches them
+// concurrently. Files complete in order.
+error XReadFilesEx(Arena *a, const char **paths, u32 count, FileCallback cb, void *ctx)
+{
+    if (a == NULL || paths == NULL || cb == NULL)
+        return ERR_NULL_PTR;
+    if (!Ok(*a))
+        return a->err;
+
+    FileHandle ahead[BATCH_MAX_INFLIGHT];
+    u32 opened = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        for (; opened < count && opened < i + BATCH_MAX_INFLIGHT; opened++)
+        {
+            FileHandle file = paths[opened] != NULL ? xfileOpen(paths[opened]) : xfileInvalid;
+            if (file != xfileInvalid)
+                xfileAdvise(file, 0, 0, POSIX_FADV_WILLNEED);
+            ahead[opened % BATCH_MAX_INFLIGHT] = file;
+        }
+
+        File f = {0};
+        FileHandle file = ahead[i % BATCH_MAX_INFLIGHT];
+        if (paths[i] == NULL)
+            f.err = ERR_NULL_PTR;
+        else if (file == xfileInvalid)
+            f.err = ERR_FILE_READ;
+        else
+            f.err = readOpenFile(a, file, &f);
+
+        if (paths[i] != NULL)
+        {
+            strncpy(f.filepath, paths[i], sizeof(f.filepath) - 1);
+            f.filepath[sizeof(f.filepath) - 1] = 0;
+        }
+        cb(&f, i, ctx);
+    }
+    return ERR_NO_ERROR;
+}
+
+#endif
+
+static void collectFile(File *f, u32 index, void *ctx)
+{
+    File *files = ctx;
+    files[index] = *f;
+}
+
+File *XReadFiles(Arena *a, const char **paths, u32 count)
+{
+    File *files = ListCreate(sizeof(File), count);
+    if (files == NULL)
+        return NULL;
+
+    if (XReadFilesEx(a, paths, count, collectFile, files) != ERR_NO_ERROR)
+    {
+        ListFree(files);
+        return NULL;
+    }
+
+    getHeader(files)->length = count;
+    return files;
+}
+
+File *XReadDirFiles(Arena *a, const char *path)
+{
+    if (a == NULL || path == NULL)
+        return NULL;
+
+    FileIter iter = XReadDir(path);
+    if (!Ok(iter))
+        return NULL;
+
+    u32 count = 0;
+    u32 cap = 64;
+    const char **paths = xdefaultAlloc(sizeof(char *) * cap);
+
+    while (Ok(iter) && paths != NULL)
+    {
+        File entry = FileIterNext(&iter);
+        if (!Ok(entry) || entry.isDir)
+            continue;
+
+        if (count == cap)
+        {
+            cap *= 2;
+            const char **grown = xdefaultRealloc(paths, sizeof(char *) * cap);
+            if (grown == NULL)
+                xdefaultFree(paths);
+            paths = grown;
+            if (paths == NULL)
+                break;
+        }
+
+        // Full path is built in the arena next to the file contents
+        u32 dirLength = strlen(path);
+        u32 nameLength = strlen(entry.filepath);
+        char *full = ArenaAlloc(a, dirLength + nameLength + 2);
+        if (full == NULL)
+            break;
+
+        memcpy(full, path, dirLength);
+        full[dirLength] = PATH_SEPARATOR;
+        memcpy(full + dirLength + 1, entry.filepath, nameLength + 1);
+        paths[count++] = full;
+    }
+
+    if (Ok(iter))
+        XCloseFileIter(&iter);
+    if (paths == NULL || !Ok(*a))
+    {
+        if (paths != NULL)
+            xdefaultFree(paths);
+        return NULL;
+    }
+
+    File *files = XReadFiles(a, paths, count);
+    xdefaultFree(paths);
+    return files;
+}
+
+// Default buffer size of XWriterNew and XWriterNewAsync
+#define WRITER_BUFFER_SIZE (1 << 20)
+
+// Background flush state. The caller fills one buffer while the thread writes
+// the other.
+typedef struct WriterAsync
+{
+    xthread thread;
+    xmutex lock;
+    xcond wake;
+    char *buffers[2];
+    char *pending; // Buffer handed to the thread, NULL when it is idle
+    u32 pendingLength;
+    u32 current; // Index of buffer being filled
+    bool stop;
+    error err;
+} WriterAsync;
+
+static Writer *printWriter = NULL;
+
+// Writes all n bytes, a single write may write less than asked for.
+static error writeAll(FileHandle handle, const char *data, u64 n)
+{
+    while (n > 0)
+    {
+        u32 chunk = n > READ_CHUNK_SIZE ? READ_CHUNK_SIZE : (u32)n;
+        u32 written = 0;
+        if (!xfileWrite(handle, data, chunk, &written) || written == 0)
+            return ERR_FILE_WRITE;
+        data += written;
+        n -= written;
+    }
+    return ERR_NO_ERROR;
+}
+
+static xthreadResult xthreadCall writerThread(void *arg)
+{
+    WriterAsync *async = ((Writer *)arg)->async;
+    FileHandle handle = ((Writer *)arg)->handle;
+
+    xlock(&async->lock);
+    for (;;)
+    {
+        while (async->pending == NULL && !async->stop)
+            xcondWait(&async->wake, &async->lock);
+        if (async->pending == NULL)
+            break;
+
+        char *data = async->pending;
+        u32 length = async->pendingLength;
+        xunlock(&async->lock);
+
+        error err = writeAll(handle, data, length);
+
+        xlock(&async->lock);
+        if (err && !async->err)
+            async->err = err;
+        async->pending = NULL;
+        xcondWakeAll(&async->wake);
+    }
+    xunlock(&async->lock);
+    return 0;
+}
+
+Writer XWriterNew(FileHandle handle, Arena *a, u32 size)
+{
+#ifdef _WIN32
+    if (handle == NULL || handle == INVALID_HANDLE_VALUE)
+#else
+    if (handle < 0)
+#endif
+        return (Writer){.err = ERR_NULL_PTR};
+    if (size == 0)
+        size = WRITER_BUFFER_SIZE;
+
+    char *buffer = a != NULL ? ArenaAlloc(a, size) : xdefaultAlloc(size);
+    if (buffer == NULL)
+        return (Writer){.err = ERR_NO_MEMORY};
+
+    return (Writer){
+        .handle = handle,
+        .buffer = buffer,
+        .length = 0,
+        .cap = size,
+        .heap = a == NULL,
+        .async = NULL,
+        .err = ERR_NO_ERROR,
+    };
+}
+
+Writer XWriterNewAsync(FileHandle handle, u32 size)
+{
+    Writer w = XWriterNew(handle, NULL, size);
+    if (!Ok(w))
+        return w;
+
+    // The thread reads the writer through this pointer, so the async state
+    // and a copy of the handle live on the heap
+    Writer *shared = xdefaultAlloc(sizeof(Writer) + sizeof(WriterAsync));
+    char *second = xdefaultAlloc(w.cap);
+    if (shared == NULL || second == NULL)
+    {
+        if (shared != NULL)
+            xdefaultFree(shared);
+        if (second != NULL)
+            xdefaultFree(second);
+        xdefaultFree(w.buffer);
+        return (Writer){.err = ERR_NO_MEMORY};
+    }
+
+    WriterAsync *async = (WriterAsync *)(shared + 1);
+    *async = (WriterAsync){
+        .buffers = {w.buffer, second},
+        .current = 0,
+    };
+    xmutexInit(&async->lock);
+    xcondInit(&async->wake);
+    *shared = (Writer){.handle = handle, .async = async};
+
+    if (!xthreadStart(&async->thread, writerThread, shared))
+    {
+        xdefaultFree(second);
+        xdefaultFree(w.buffer);
+        xdefaultFree(shared);
+        return (Writer){.err = ERR_NO_MEMORY};
+    }
+
+    w.async = async;
+    return w;
+}
+
+// Hands the filled buffer to the writer thread once it is done with the
+// previous one, then continues in the other buffer.
+static void writerHandOff(Writer *w)
+{
+    WriterAsync *async = w->async;
+
+    xlock(&async->lock);
+    while (async->pending != NULL)
+        xcondWait(&async->wake, &async->lock);
+
+    if (async->err)
+        w->err = async->err;
+    if (w->length > 0)
+    {
+        async->pending = w->buffer;
+        async->pendingLength = w->length;
+        async->current ^= 1;
+        w->buffer = async->buffers[async->current];
+        w->length = 0;
+        xcondWakeAll(&async->wake);
+    }
+    xunlock(&async->lock);
+}
+
+// Waits until the writer thread has written everything handed to it.
+static void writerDrain(Writer *w)
+{
+    WriterAsync *async = w->async;
+
+    xlock(&async->lock);
+    while (async->pending != NULL)
+        xcondWait(&async->wake, &async->lock);
+    if (async->err)
+        w->err = async->err;
+    xunlock(&async->lock);
+}
+
+error WriterFlush(Writer *w)
+{
+    if (w == NULL)
+        return ERR_NULL_PTR;
+    if (!Ok(*w))
+        return w->err;
+
+    if (w->async != NULL)
+    {
+        writerHandOff(w);
+        writerDrain(w);
+        return w->err;
+    }
+
+    if (w->length > 0)
+    {
+        w->err = writeAll(w->handle, w->buffer, w->length);
+        w->length = 0;
+    }
+    return w->err;
+}
+
+void WriterWriteRaw(Writer *w, const char *data, u32 n)
+{
+    if (w == NULL || data == NULL || !Ok(*w))
+        return;
+
+    if (w->length + (u64)n <= w->cap)
+    {
+        memcpy(w->buffer + w->length, data, n);
+        w->length += n;
+        return;
+    }
+
+    // Top up the buffer so every write is a full block
+    u32 fill = w->cap - w->length;
+    memcpy(w->buffer + w->length, data, fill);
+    w->length = w->cap;
+    data += fill;
+    n -= fill;
+
+    if (w->async != NULL)
+    {
+        while (Ok(*w))
+        {
+            writerHandOff(w);
+            u32 chunk = n < w->cap ? n : w->cap;
+            memcpy(w->buffer, data, chunk);
+            w->length = chunk;
+            data += chunk;
+            n -= chunk;
+            if (n == 0)
+                break;
+        }
+        return;
+    }
+
+    if (WriterFlush(w) != ERR_NO_ERROR)
+        return;
+
+    // Large writes bypass the buffer
+    if (n >= w->cap)
+    {
+        w->err = writeAll(w->handle, data, n);
+        return;
+    }
+
+    memcpy(w->buffer, data, n);
+    w->length = n;
+}
+
+// Invalid strings are skipped, the writer error is only for failed writes
+void WriterWrite(Writer *w, String s)
+{
+    if (w == NULL || !Ok(s))
+        return;
+    WriterWriteRaw(w, s.str, s.length);
+}
+
+void WriterWriteLine(Writer *w, String s)
+{
+    if (w == NULL || !Ok(s))
+        return;
+    WriterWriteRaw(w, s.str, s.length);
+    WriterWriteRaw(w, "\n", 1);
+}
+
+error WriterClose(Writer *w)
+{
+    if (w == NULL)
+        return ERR_NULL_PTR;
+    if (w->buffer == NULL)
+        return w->err;
+
+    WriterFlush(w);
+    if (printWriter == w)
+        printWriter = NULL;
+
+    WriterAsync *async = w->async;
+    if (async != NULL)
+    {
+        xlock(&async->lock);
+        async->stop = true;
+        xcondWakeAll(&async->wake);
+        xunlock(&async->lock);
+
+        xthreadJoin(async->thread);
+        if (async->err && Ok(*w))
+            w->err = async->err;
+
+        xdefaultFree(async->buffers[0]);
+        xdefaultFree(async->buffers[1]);
+        xdefaultFree((Writer *)async - 1);
+    }
+    else if (w->heap)
+        xdefaultFree(w->buffer);
+
+    w->buffer = NULL;
+    w->async = NULL;
+    w->length = 0;
+    w->cap = 0;
+    return w->err;
+}
+
+void XSetPrintWriter(Writer *w)
+{
+    printWriter = w;
+}
+
+static char lowerChar(char c)
+{
+    return c >= 'A' && c <= 'Z' ? c + 32 : c;
+}
+
+// Matches name against a single glob ending at ';' or NULL. Case insensitive
+// like the Windows file system.
+static bool globMatch(const char *glob, const char *name)
+{
+    const char *star = NULL;
+    const char *retry = NULL;
+
+    while (*name)
+    {
+        if (*glob == '*')
+        {
+            star = ++glob;
+            retry = name;
+        }
+        else if (*glob && *glob != ';' && (*glob == '?' || lowerChar(*glob) == lowerChar(*name)))
+        {
+            glob++;
+            name++;
+        }
+        else if (star != NULL)
+        {
+            glob = star;
+            name = ++retry;
+        }
+        else
+            return false;
+    }
+
+    while (*glob == '*')
+        glob++;
+    return *glob == 0 || *glob == ';';
+}
+
+static bool filterMatch(const char *filter, const char *name)
+{
+    if (filter == NULL)
+        return true;
+
+    for (const char *glob = filter;; glob++)
+    {
+        if (globMatch(glob, name))
+            return true;
+
+        glob = strchr(glob, ';');
+        if (glob == NULL)
+            return false;
+    }
+}
+
+// Copies s into the arena, or the default allocator if a is NULL
+static String strCopyTerminated(Arena *a, const char *s, u32 length)
+{
+    char *str = a != NULL ? ArenaAlloc(a, length + 1) : xdefaultAlloc(length + 1);
+    if (str == NULL)
+        return (String){.err = ERR_NO_MEMORY};
+
+    memcpy(str, s, length);
+    str[length] = 0;
+    return (String){.err = ERR_NO_ERROR, .length = length, .str = str};
+}
+
+// Returns dir\name allocated in the arena and NULL terminated.
+static String pathJoin(Arena *a, String dir, const char *name, u32 nameLength)
+{
+    u32 length = dir.length + 1 + nameLength;
+    char *str = ArenaAlloc(a, length + 1);
+    if (str == NULL)
+        return (String){.err = ERR_NO_MEMORY};
+
+    memcpy(str, dir.str, dir.length);
+    str[dir.length] = PATH_SEPARATOR;
+    memcpy(str + dir.length + 1, name, nameLength);
+    str[length] = 0;
+    return (String){.err = ERR_NO_ERROR, .length = length, .str = str};
+}
+
+typedef struct WalkState
+{
+    Arena *arena;
+    const char *filter;
+    u32 flags;
+    String *results;
+    String *pending; // Directories left to walk
+    u32 active;      // Threads currently walking a directory
+    xmutex lock;
+    xcond wake;
+} WalkState;
+
+// Lists a single directory. Paths are allocated in scratch and added to found
+// and dirs, which are returned as they may move.
+#ifdef _WIN32
+static void walkOne(WalkState *w, Arena *scratch, String dir, String **found, String **dirs)
+{
+    String pattern = pathJoin(scratch, dir, "*", 1);
+    if (!Ok(pattern))
+        return;
+
+    WIN32_FIND_DATAA data;
+    HANDLE hFind = FindFirstFileExA(pattern.str, FindExInfoBasic, &data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return;
+
+    do
+    {
+        char *name = data.cFileName;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+
+        bool isDir = data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+        bool isLink = data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT;
+        bool match = (!isDir || (w->flags & WALK_DIRS)) && filterMatch(w->filter, name);
+        bool descend = isDir && !isLink && (w->flags & WALK_RECURSIVE);
+        if (!match && !descend)
+            continue;
+
+        String full = pathJoin(scratch, dir, name, strlen(name));
+        if (!Ok(full))
+            break;
+
+        if (match)
+            *found = ListPush(*found, (u64)&full);
+        if (descend)
+            *dirs = ListPush(*dirs, (u64)&full);
+    } while (FindNextFileA(hFind, &data));
+
+    FindClose(hFind);
+}
+#else
+static void walkOne(WalkState *w, Arena *scratch, String dir, String **found, String **dirs)
+{
+    DIR *d = opendir(dir.str);
+    if (d == NULL)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL)
+    {
+        char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+
+        // Links to directories count as directories but are not followed,
+        // as with reparse points on Windows. Only links and file systems
+        // without d_type need a stat.
+        bool isDir = entry->d_type == DT_DIR;
+        bool isLink = entry->d_type == DT_LNK;
+        if (isLink || entry->d_type == DT_UNKNOWN)
+        {
+            struct stat st;
+            if (fstatat(dirfd(d), name, &st, isLink ? 0 : AT_SYMLINK_NOFOLLOW) == 0)
+            {
+                isDir = S_ISDIR(st.st_mode);
+                isLink = isLink || S_ISLNK(st.st_mode);
+            }
+        }
+
+        bool match = (!isDir || (w->flags & WALK_DIRS)) && filterMatch(w->filter, name);
+        bool descend = isDir && !isLink && (w->flags & WALK_RECURSIVE);
+        if (!match && !descend)
+            continue;
+
+        String full = pathJoin(scratch, dir, name, strlen(name));
+        if (!Ok(full))
+            break;
+
+        if (match)
+            *found = ListPush(*found, (u64)&full);
+        if (descend)
+            *dirs = ListPush(*dirs, (u64)&full);
+    }
+
+    closedir(d);
+}
+#endif
+
+// Takes directories from the shared stack until all are walked. Each
+// directory is listed into scratch memory without holding the lock, then
+// results are copied into the result arena in one go. Pending directories
+// are only needed until walked, so they live on the heap.
+static xthreadResult xthreadCall walkWorker(void *arg)
+{
+    WalkState *w = arg;
+    Arena *scratch = ArenaScratch(w->arena);
+    String *found = ListCreate(sizeof(String), 64);
+    String *dirs = ListCreate(sizeof(String), 16);
+
+    xlock(&w->lock);
+    for (;;)
+    {
+        while (len(w->pending) == 0 && w->active > 0)
+            xcondWait(&w->wake, &w->lock);
+        if (len(w->pending) == 0)
+            break;
+
+        String dir = *(String *)ListPop(w->pending);
+        w->active++;
+        xunlock(&w->lock);
+
+        ArenaMark mark = ArenaSave(scratch);
+        walkOne(w, scratch, dir, &found, &dirs);
+        xdefaultFree(dir.str);
+
+        xlock(&w->lock);
+        for (int i = 0; i < len(found); i++)
+        {
+            String path = strCopyTerminated(w->arena, found[i].str, found[i].length);
+            if (Ok(path))
+                w->results = ListPush(w->results, (u64)&path);
+        }
+        for (int i = 0; i < len(dirs); i++)
+        {
+            String path = strCopyTerminated(NULL, dirs[i].str, dirs[i].length);
+            if (Ok(path))
+                w->pending = ListPush(w->pending, (u64)&path);
+        }
+
+        getHeader(found)->length = 0;
+        getHeader(dirs)->length = 0;
+        ArenaRestore(scratch, mark);
+        w->active--;
+        xcondWakeAll(&w->wake);
+    }
+    xunlock(&w->lock);
+
+    ListFree(found);
+    ListFree(dirs);
+    return 0;
+}
+
+static xthreadResult xthreadCall walkThread(void *arg)
+{
+    walkWorker(arg);
+    ArenaFreeScratch();
+    return 0;
+}
+
+String *XWalkDir(Arena *a, const char *path, const char *filter, u32 flags)
+{
+    if (a == NULL || path == NULL)
+        return NULL;
+    if (!Ok(*a))
+        return NULL;
+
+    WalkState w = {
+        .arena = a,
+        .filter = filter,
+        .flags = flags,
+        .results = ListCreate(sizeof(String), 64),
+        .pending = ListCreate(sizeof(String), 16),
+    };
+    xmutexInit(&w.lock);
+    xcondInit(&w.wake);
+
+    u32 length = strlen(path);
+    while (length > 0 && (path[length - 1] == '\\' || path[length - 1] == '/'))
+        length--;
+
+    String root = strCopyTerminated(NULL, path, length);
+    if (Ok(root))
+        w.pending = ListPush(w.pending, (u64)&root);
+
+    xthread threads[WALK_MAX_THREADS];
+    u32 threadCount = 0;
+    if (flags & WALK_PARALLEL)
+    {
+        u32 cpus = xcpuCount();
+        u32 wanted = cpus < WALK_MAX_THREADS ? cpus : WALK_MAX_THREADS;
+
+        // The calling thread is one of the workers
+        for (u32 i = 1; i < wanted; i++)
+            if (xthreadStart(&threads[threadCount], walkThread, &w))
+                threadCount++;
+    }
+
+    walkWorker(&w);
+
+    for (u32 i = 0; i < threadCount; i++)
+        xthreadJoin(threads[i]);
+
+    ListFree(w.pending);
+    return w.results;
+}
+
+#define returnIfError(s) \
+    if (!Ok(s))          \
+        return (String) { .err = (s).err, .length = 0 }
+
+#ifdef LIBX_SIMD_X86
+
+static int avx2Support = -1;
+
+static bool hasAVX2(void)
+{
+    if (avx2Support < 0)
+    {
+#ifdef _MSC_VER
+        // AVX2 needs both CPU support and the OS saving ymm registers
+        int info[4];
+        __cpuid(info, 0);
+        bool avx2 = false;
+        if (info[0] >= 7)
+        {
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+            __cpuidex(info, 7, 0);
+            avx2 = osxsave && (info[1] & (1 << 5)) && (_xgetbv(0) & 6) == 6;
+        }
+        avx2Support = avx2;
+#else
+        __builtin_cpu_init();
+        avx2Support = __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+    return avx2Support;
+}
+
+xtargetAVX2 static u32 findCharAVX2(const char *p, u32 n, char c)
+{
+    __m256i needle = _mm256_set1_epi8(c);
+    u32 i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(p + i));
+        u32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if (mask)
+            return i + xctz(mask);
+    }
+    for (; i < n; i++)
+        if (p[i] == c)
+            return i;
+    return n;
+}
+
+// Byte counters are summed with sad before they can overflow
+xtargetAVX2 static u32 countCharAVX2(const char *p, u32 n, char c)
+{
+    __m256i needle = _mm256_set1_epi8(c);
+    u64 count = 0;
+    u32 i = 0;
+    while (i + 32 <= n)
+    {
+        __m256i counts = _mm256_setzero_si256();
+        for (int j = 0; j < 255 && i + 32 <= n; j++, i += 32)
+        {
+            __m256i chunk = _mm256_loadu_si256((const __m256i *)(p + i));
+            counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(chunk, needle));
+        }
+
+        __m256i sums = _mm256_sad_epu8(counts, _mm256_setzero_si256());
+        count += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+                 _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+    }
+    for (; i < n; i++)
+        count += p[i] == c;
+    return count;
+}
+
+#endif
+
+// Returns index of first c in p, n if not found.
+static u32 findChar(const char *p, u32 n, char c)
+{
+    u32 i = 0;
+#ifdef LIBX_SIMD_X86
+    if (n >= 32 && hasAVX2())
+        return findCharAVX2(p, n, c);
+
+    __m128i needle = _mm_set1_epi8(c);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(p + i));
+        u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask)
+            return i + xctz(mask);
+    }
+#endif
+    for (; i < n; i++)
+        if (p[i] == c)
+            return i;
+    return n;
+}
+
+// Returns number of times c appears in p.
+static u32 countChar(const char *p, u32 n, char c)
+{
+    u64 count = 0;
+    u32 i = 0;
+#ifdef LIBX_SIMD_X86
+    if (n >= 32 && hasAVX2())
+        return countCharAVX2(p, n, c);
+
+    __m128i needle = _mm_set1_epi8(c);
+    while (i + 16 <= n)
+    {
+        __m128i counts = _mm_setzero_si128();
+        for (int j = 0; j < 255 && i + 16 <= n; j++, i += 16)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i *)(p + i));
+            counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(chunk, needle));
+        }
+
+        __m128i sums = _mm_sad_epu8(counts, _mm_setzero_si128());
+        count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+    }
+#endif
+    for (; i < n; i++)
+        count += p[i] == c;
+    return count;
+}
+
+String StrAlloc(Arena *a, const char *s)
+{
+    if (s == NULL || a == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    returnIfError(*a);
+
+    int length = strlen(s);
+    char *p = ArenaAlloc(a, length);
+    if (p == NULL)
+        return (String){
+            .err = ERR_NO_MEMORY,
+            .length = 0,
+            .str = NULL,
+        };
+
+    memcpy(p, s, length);
+    return (String){
+        .err = ERR_NO_ERROR,
+        .length = length,
+        .str = p,
+    };
+}
+
+void prints(String s)
+{
+    if (printWriter != NULL)
+    {
+        if (s.err)
+            WriterWriteLine(printWriter, STRING("STRING_ERROR"));
+        WriterWriteLine(printWriter, (String){.str = s.str, .length = s.length});
+        return;
+    }
+
+    if (s.err)
+        printf("STRING_ERROR\n");
+    printf("%.*s\n", s.length, s.str);
+}
+
+String StrSub(String s, u32 start, u32 end)
+{
+    return (String){
+        .str = s.str + start,
+        .length = end - start,
+        .err = s.err,
+    };
+}
+
+// Words up to this length are found with a first and last byte filter,
+// longer ones with Boyer-Moore-Horspool
+#define SHORT_WORD_LENGTH 32
+
+#ifdef LIBX_SIMD_X86
+
+// Compares the first and last byte of word at 32 positions at once, then
+// verifies the candidates. Returns position of the match, or the first
+// position that was not checked.
+xtargetAVX2 static u32 findWordAVX2(const char *s, u32 n, const char *word, u32 wordlen, bool *found)
+{
+    __m256i first = _mm256_set1_epi8(word[0]);
+    __m256i last = _mm256_set1_epi8(word[wordlen - 1]);
+    u32 i = 0;
+    for (; i + 32 <= n - wordlen + 1; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + wordlen - 1));
+        u32 mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask)
+        {
+            u32 pos = i + xctz(mask);
+            if (memcmp(s + pos + 1, word + 1, wordlen - 2) == 0)
+            {
+                *found = true;
+                return pos;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return i;
+}
+
+#endif
+
+// Requires 2 <= wordlen <= n.
+static u32 findWordShort(const char *s, u32 n, const char *word, u32 wordlen)
+{
+    u32 i = 0;
+#ifdef LIBX_SIMD_X86
+    bool found = false;
+    if (n - wordlen + 1 >= 32 && hasAVX2())
+    {
+        i = findWordAVX2(s, n, word, wordlen, &found);
+        if (found)
+            return i;
+    }
+
+    __m128i first = _mm_set1_epi8(word[0]);
+    __m128i last = _mm_set1_epi8(word[wordlen - 1]);
+    for (; i + 16 <= n - wordlen + 1; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + wordlen - 1));
+        u32 mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask)
+        {
+            u32 pos = i + xctz(mask);
+            if (memcmp(s + pos + 1, word + 1, wordlen - 2) == 0)
+                return pos;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + wordlen <= n; i++)
+        if (s[i] == word[0] && s[i + wordlen - 1] == word[wordlen - 1] && memcmp(s + i + 1, word + 1, wordlen - 2) == 0)
+            return i;
+    return -1;
+}
+
+static void horspoolTable(u32 *skip, const char *word, u32 wordlen)
+{
+    for (int i = 0; i < 256; i++)
+        skip[i] = wordlen;
+    for (u32 i = 0; i + 1 < wordlen; i++)
+        skip[(u8)word[i]] = wordlen - 1 - i;
+}
+
+static u32 findWordLong(const char *s, u32 n, const char *word, u32 wordlen, const u32 *skip)
+{
+    char last = word[wordlen - 1];
+    for (u32 pos = 0; pos + wordlen <= n; pos += skip[(u8)s[pos + wordlen - 1]])
+        if (s[pos + wordlen - 1] == last && memcmp(s + pos, word, wordlen - 1) == 0)
+            return pos;
+    return -1;
+}
+
+// Skip is the Horspool table for word, or NULL to build it when needed.
+u32 _strFindWordEx(String s, const char *word, u32 wordlen, const u32 *skip)
+{
+    if (!Ok(s) || word == NULL)
+        return -1;
+    if (wordlen == 0)
+        return 0;
+    if (wordlen > s.length)
+        return -1;
+    if (wordlen == 1)
+        return StrFind(s, word[0]);
+    if (wordlen <= SHORT_WORD_LENGTH)
+        return findWordShort(s.str, s.length, word, wordlen);
+
+    u32 table[256];
+    if (skip == NULL)
+    {
+        horspoolTable(table, word, wordlen);
+        skip = table;
+    }
+    return findWordLong(s.str, s.length, word, wordlen, skip);
+}
+
+u32 StrFindWord(String s, char *word)
+{
+    if (word == NULL)
+        return -1;
+    return _strFindWordEx(s, word, strlen(word), NULL);
+}
+
+u32 StrFindString(String s, String word)
+{
+    if (!Ok(word))
+        return -1;
+    return _strFindWordEx(s, word.str, word.length, NULL);
+}
+
+StrSearcher StrSearcherNew(String word)
+{
+    if (!Ok(word))
+        return (StrSearcher){.err = word.err};
+
+    StrSearcher searcher = {.word = word};
+    horspoolTable(searcher.skip, word.str, word.length);
+    return searcher;
+}
+
+u32 StrSearch(StrSearcher *searcher, String s)
+{
+    if (searcher == NULL || !Ok(*searcher))
+        return -1;
+    return _strFindWordEx(s, searcher->word.str, searcher->word.length, searcher->skip);
+}
+
+String StrCopy(Arena *a, String s)
+{
+    if (a == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    returnIfError(s);
+
+    char *str = ArenaAlloc(a, s.length);
+    if (str == NULL)
+        return (String){.err = ERR_NO_MEMORY};
+
+    memcpy(str, s.str, s.length);
+    return (String){.err = ERR_NO_ERROR, .length = s.length, .str = str};
+}
+
+char CharAt(String s, u32 pos)
+{
+    if (!Ok(s))
+        panic("CharAt on string with error\n");
+    if (s.length <= pos)
+        panic("string index out of bounds\n");
+
+    return *(s.str + pos);
+}
+
+u32 StrCount(String s, char c)
+{
+    if (!Ok(s))
+        return 0;
+
+    return countChar(s.str, s.length, c);
+}
+
+#ifdef LIBX_SIMD_X86
+
+// Returns mask of bytes in the range lo to hi. Shifting by 128 - lo moves the
+// range to the bottom of the signed range so one compare is enough.
+static inline __m128i rangeMask(__m128i chunk, char lo, char hi)
+{
+    __m128i shifted = _mm_add_epi8(chunk, _mm_set1_epi8((char)(0x80 - lo)));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + (hi - lo) + 1)));
+}
+
+static inline __m128i lowerChunk(__m128i chunk)
+{
+    return _mm_xor_si128(chunk, _mm_and_si128(rangeMask(chunk, 'A', 'Z'), _mm_set1_epi8(0x20)));
+}
+
+xtargetAVX2 static void flipCaseAVX2(char *p, u32 n, char lo, char hi)
+{
+    __m256i offset = _mm256_set1_epi8((char)(0x80 - lo));
+    __m256i limit = _mm256_set1_epi8((char)(0x80 + (hi - lo)));
+    __m256i bit = _mm256_set1_epi8(0x20);
+    u32 i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i outside = _mm256_cmpgt_epi8(_mm256_add_epi8(chunk, offset), limit);
+        _mm256_storeu_si256((__m256i *)(p + i), _mm256_xor_si256(chunk, _mm256_andnot_si256(outside, bit)));
+    }
+    for (; i < n; i++)
+        if (p[i] >= lo && p[i] <= hi)
+            p[i] ^= 0x20;
+}
+
+#endif
+
+// Flips the case bit of all bytes in the range lo to hi.
+static void flipCase(char *p, u32 n, char lo, char hi)
+{
+    u32 i = 0;
+#ifdef LIBX_SIMD_X86
+    if (n >= 32 && hasAVX2())
+    {
+        flipCaseAVX2(p, n, lo, hi);
+        return;
+    }
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i flip = _mm_and_si128(rangeMask(chunk, lo, hi), _mm_set1_epi8(0x20));
+        _mm_storeu_si128((__m128i *)(p + i), _mm_xor_si128(chunk, flip));
+    }
+#endif
+    for (; i < n; i++)
+        if (p[i] >= lo && p[i] <= hi)
+            p[i] ^= 0x20;
+}
+
+String StrUpperInPlace(String s)
+{
+    if (Ok(s))
+        flipCase(s.str, s.length, 'a', 'z');
+    return s;
+}
+
+String StrLowerInPlace(String s)
+{
+    if (Ok(s))
+        flipCase(s.str, s.length, 'A', 'Z');
+    return s;
+}
+
+String StrUpper(Arena *a, String s)
+{
+    if (a == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    returnIfError(s);
+
+    return StrUpperInPlace(StrCopy(a, s));
+}
+
+String StrLower(Arena *a, String s)
+{
+    if (a == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    returnIfError(s);
+
+    return StrLowerInPlace(StrCopy(a, s));
+}
+
+// Returns true if the first n bytes of a and b are equal ignoring case.
+static bool equalNoCase(const char *a, const char *b, u32 n)
+{
+    u32 i = 0;
+#ifdef LIBX_SIMD_X86
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x = lowerChunk(_mm_loadu_si128((const __m128i *)(a + i)));
+        __m128i y = lowerChunk(_mm_loadu_si128((const __m128i *)(b + i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+            return false;
+    }
+#endif
+    for (; i < n; i++)
+        if (lowerChar(a[i]) != lowerChar(b[i]))
+            return false;
+    return true;
+}
+
+bool StrCompareNoCase(String a, String b)
+{
+    if (!Ok(a) || !Ok(b))
+        return false;
+    if (a.length != b.length)
+        return false;
+    return equalNoCase(a.str, b.str, a.length);
+}
+
+u32 StrFindStringNoCase(String s, String word)
+{
+    if (!Ok(s) || !Ok(word))
+        return -1;
+    if (word.length == 0)
+        return 0;
+    if (word.length > s.length)
+        return -1;
+
+    u32 n = s.length;
+    u32 wordlen = word.length;
+    char first = lowerChar(word.str[0]);
+    char last = lowerChar(word.str[wordlen - 1]);
+    u32 i = 0;
+
+#ifdef LIBX_SIMD_X86
+    // Same first and last byte filter as StrFindString, on lowered bytes
+    __m128i firsts = _mm_set1_epi8(first);
+    __m128i lasts = _mm_set1_epi8(last);
+    for (; i + 16 <= n - wordlen + 1; i += 16)
+    {
+        __m128i a = lowerChunk(_mm_loadu_si128((const __m128i *)(s.str + i)));
+        __m128i b = lowerChunk(_mm_loadu_si128((const __m128i *)(s.str + i + wordlen - 1)));
+        u32 mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, firsts), _mm_cmpeq_epi8(b, lasts)));
+        while (mask)
+        {
+            u32 pos = i + xctz(mask);
+            if (equalNoCase(s.str + pos, word.str, wordlen))
+                return pos;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + wordlen <= n; i++)
+        if (lowerChar(s.str[i]) == first && equalNoCase(s.str + i, word.str, wordlen))
+            return i;
+    return -1;
+}
+
+StringIter StrToIterator(String s)
+{
+    return (StringIter){
+        .err = s.err,
+        .pos = 0,
+        .s = s,
+    };
+}
+
+StringIter StrToIteratorEx(char *string, u32 length)
+{
+    return (StringIter){
+        .err = 0,
+        .pos = 0,
+        .s = (String){
+            .err = 0,
+            .str = string,
+            .length = length,
+        },
+    };
+}
+
+String StrSplit(StringIter *iter, char delim)
+{
+    if (iter == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    if (!Ok(*iter))
+        return (String){.err = iter->err};
+
+    u32 start = iter->pos;
+    u32 left = iter->s.length - start;
+    u32 length = findChar(iter->s.str + start, left, delim);
+    if (length < left)
+    {
+        iter->pos += length + 1;
+        return (String){
+            .length = length,
+            .str = iter->s.str + start,
+            .err = ERR_NO_ERROR,
+        };
+    }
+
+    iter->pos = iter->s.length;
+    iter->err = ERR_ITERATION_FINISH;
+    return (String){
+        .length = iter->pos - start,
+        .str = iter->s.str + start,
+        .err = ERR_NO_ERROR,
+    };
+}
+
+// Sets with up to this many delimiters are matched with one SIMD compare per
+// delimiter, larger sets with a lookup table
+#define SIMD_MAX_DELIMS 8
+
+typedef struct DelimSet
+{
+    u64 table[4]; // One bit per byte value
+    const char *delims;
+    u32 count;
+} DelimSet;
+
+static DelimSet delimSet(const char *delims)
+{
+    DelimSet set = {.delims = delims, .count = strlen(delims)};
+    for (u32 i = 0; i < set.count; i++)
+    {
+        u8 c = delims[i];
+        set.table[c >> 6] |= 1ull << (c & 63);
+    }
+    return set;
+}
+
+#define delimSetHas(set, c) (((set)->table[(u8)(c) >> 6] >> ((u8)(c) & 63)) & 1)
+
+#ifdef LIBX_SIMD_X86
+
+xtargetAVX2 static u32 findAnyAVX2(const char *p, u32 n, const DelimSet *set)
+{
+    __m256i delims[SIMD_MAX_DELIMS];
+    for (u32 d = 0; d < set->count; d++)
+        delims[d] = _mm256_set1_epi8(set->delims[d]);
+
+    u32 i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i hits = _mm256_cmpeq_epi8(chunk, delims[0]);
+        for (u32 d = 1; d < set->count; d++)
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, delims[d]));
+
+        u32 mask = _mm256_movemask_epi8(hits);
+        if (mask)
+            return i + xctz(mask);
+    }
+    for (; i < n; i++)
+        if (delimSetHas(set, p[i]))
+            return i;
+    return n;
+}
+
+#endif
+
+// Returns index of first byte in p which is in the set, n if not found.
+static u32 findAny(const char *p, u32 n, const DelimSet *set)
+{
+    u32 i = 0;
+    if (set->count == 0)
+        return n;
+    if (set->count == 1)
+        return findChar(p, n, set->delims[0]);
+
+#ifdef LIBX_SIMD_X86
+    if (set->count <= SIMD_MAX_DELIMS)
+    {
+        if (n >= 32 && hasAVX2())
+            return findAnyAVX2(p, n, set);
+
+        __m128i delims[SIMD_MAX_DELIMS];
+        for (u32 d = 0; d < set->count; d++)
+            delims[d] = _mm_set1_epi8(set->delims[d]);
+
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i *)(p + i));
+            __m128i hits = _mm_cmpeq_epi8(chunk, delims[0]);
+            for (u32 d = 1; d < set->count; d++)
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, delims[d]));
+
+            u32 mask = _mm_movemask_epi8(hits);
+            if (mask)
+                return i + xctz(mask);
+        }
+    }
+#endif
+    for (; i < n; i++)
+        if (delimSetHas(set, p[i]))
+            return i;
+    return n;
+}
+
+String StrSplitAny(StringIter *iter, const char *delims)
+{
+    if (iter == NULL || delims == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    if (!Ok(*iter))
+        return (String){.err = iter->err};
+
+    DelimSet set = delimSet(delims);
+    u32 start = iter->pos;
+    u32 left = iter->s.length - start;
+    u32 length = findAny(iter->s.str + start, left, &set);
+    if (length < left)
+    {
+        iter->pos += length + 1;
+        return (String){
+            .length = length,
+            .str = iter->s.str + start,
+            .err = ERR_NO_ERROR,
+        };
+    }
+
+    iter->pos = iter->s.length;
+    iter->err = ERR_ITERATION_FINISH;
+    return (String){
+        .length = iter->pos - start,
+        .str = iter->s.str + start,
+        .err = ERR_NO_ERROR,
+    };
+}
+
+String *StrSplitAll(Arena *a, String s, const char *delims)
+{
+    if (a == NULL || delims == NULL || !Ok(s))
+        return NULL;
+
+    // Counting first gives an exact list size, and a scan of the same
+    // bytes is cheap compared to growing the list
+    DelimSet set = delimSet(delims);
+    u32 count = 1;
+    for (u32 pos = 0;; count++)
+    {
+        pos += findAny(s.str + pos, s.length - pos, &set) + 1;
+        if (pos > s.length)
+            break;
+    }
+
+    String *parts = ListCreateArena(a, sizeof(String), count);
+    if (parts == NULL)
+        return NULL;
+
+    u32 start = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        u32 length = findAny(s.str + start, s.length - start, &set);
+        parts[i] = (String){.err = ERR_NO_ERROR, .str = s.str + start, .length = length};
+        start += length + 1;
+    }
+
+    getHeader(parts)->length = count;
+    return parts;
+}
+
+StrSpan *StrSplitSpans(Arena *a, String s, const char *delims)
+{
+    if (a == NULL || delims == NULL || !Ok(s))
+        return NULL;
+
+    DelimSet set = delimSet(delims);
+    u32 count = 1;
+    for (u32 pos = 0;; count++)
+    {
+        pos += findAny(s.str + pos, s.length - pos, &set) + 1;
+        if (pos > s.length)
+            break;
+    }
+
+    StrSpan *parts = ListCreateArena(a, sizeof(StrSpan), count);
+    if (parts == NULL)
+        return NULL;
+
+    u32 start = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        u32 length = findAny(s.str + start, s.length - start, &set);
+        parts[i] = (StrSpan){.offset = start, .length = length};
+        start += length + 1;
+    }
+
+    getHeader(parts)->length = count;
+    return parts;
+}
+
+StrSpan StrToSpan(String base, String s)
+{
+    return (StrSpan){.offset = (u32)(s.str - base.str), .length = s.length};
+}
+
+String StrSpanGet(String base, StrSpan span)
+{
+    if (!Ok(base))
+        return (String){.err = base.err};
+    return (String){.err = ERR_NO_ERROR, .str = base.str + span.offset, .length = span.length};
+}
+
+#define SMALL_STR_HEAP 0xFF
+
+#define smallStrInline(s) ((u8)(s)->buf[SMALL_STR_MAX] != SMALL_STR_HEAP)
+
+SmallStr SmallStrNew(Arena *a, String s)
+{
+    SmallStr small = {0};
+    if (!Ok(s))
+    {
+        small.heap.length = s.err;
+        small.heap.tag = SMALL_STR_HEAP;
+        return small;
+    }
+
+    if (s.length <= SMALL_STR_MAX)
+    {
+        memcpy(small.buf, s.str, s.length);
+        small.buf[SMALL_STR_MAX] = SMALL_STR_MAX - s.length;
+        return small;
+    }
+
+    small.heap.tag = SMALL_STR_HEAP;
+    small.heap.str = a != NULL ? ArenaAlloc(a, s.length + 1) : NULL;
+    if (small.heap.str == NULL)
+    {
+        small.heap.length = a != NULL ? ERR_NO_MEMORY : ERR_NULL_PTR;
+        return small;
+    }
+
+    memcpy(small.heap.str, s.str, s.length);
+    small.heap.str[s.length] = 0;
+    small.heap.length = s.length;
+    return small;
+}
+
+String SmallStrGet(const SmallStr *s)
+{
+    if (s == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    if (smallStrInline(s))
+        return (String){.err = ERR_NO_ERROR, .str = (char *)s->buf, .length = SMALL_STR_MAX - s->buf[SMALL_STR_MAX]};
+    if (s->heap.str == NULL)
+        return (String){.err = s->heap.length};
+    return (String){.err = ERR_NO_ERROR, .str = s->heap.str, .length = s->heap.length};
+}
+
+u32 SmallStrLen(const SmallStr *s)
+{
+    if (s == NULL)
+        return 0;
+    if (smallStrInline(s))
+        return SMALL_STR_MAX - s->buf[SMALL_STR_MAX];
+    return s->heap.str != NULL ? s->heap.length : 0;
+}
+
+bool SmallStrCompare(const SmallStr *a, const SmallStr *b)
+{
+    // Inline strings are zero padded, so equal strings have equal bytes.
+    // The tag makes inline and heap strings always differ here.
+    u64 a0, a1, b0, b1;
+    memcpy(&a0, a->buf, 8);
+    memcpy(&a1, a->buf + 8, 8);
+    memcpy(&b0, b->buf, 8);
+    memcpy(&b1, b->buf + 8, 8);
+    if (smallStrInline(a) || smallStrInline(b))
+        return a0 == b0 && a1 == b1;
+    return StrCompare(SmallStrGet(a), SmallStrGet(b));
+}
+
+u32 StrFind(String s, char c)
+{
+    if (!Ok(s))
+        return -1;
+
+    u32 i = findChar(s.str, s.length, c);
+    return i < s.length ? i : -1;
+}
+
+String StrConcat(Arena *a, String s1, String s2)
+{
+    if (a == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    returnIfError(s1);
+    returnIfError(s2);
+
+    int length = s1.length + s2.length;
+    char *str = ArenaAlloc(a, length);
+    if (str == NULL)
+        return (String){.err = ERR_NO_MEMORY};
+
+    memcpy(str, s1.str, s1.length);
+    memcpy(str + s1.length, s2.str, s2.length);
+    return (String){
+        .err = ERR_NO_ERROR,
+        .str = str,
+        .length = length,
+    };
+}
+
+StrBuilder StrBuilderNew(Arena *a, u32 cap)
+{
+    if (a == NULL)
+        return (StrBuilder){.err = ERR_NULL_PTR};
+    if (!Ok(*a))
+        return (StrBuilder){.err = a->err};
+
+    char *str = ArenaAlloc(a, cap);
+    if (str == NULL && cap > 0)
+        return (StrBuilder){.err = ERR_NO_MEMORY};
+
+    return (StrBuilder){
+        .arena = a,
+        .str = str,
+        .length = 0,
+        .cap = cap,
+        .err = ERR_NO_ERROR,
+    };
+}
+
+// Makes room for extra more bytes, extending the buffer in place when it is
+// still the last allocation in the arena.
+static bool sbReserve(StrBuilder *b, u64 extra)
+{
+    if (!Ok(*b))
+        return false;
+
+    u64 need = (u64)b->length + extra;
+    if (need <= b->cap)
+        return true;
+    if (need > (u32)-1)
+    {
+        b->err = ERR_NO_MEMORY;
+        return false;
+    }
+
+    u64 cap = (u64)b->cap * 2;
+    if (cap < need)
+        cap = need;
+    if (cap < 64)
+        cap = 64;
+    if (cap > (u32)-1)
+        cap = (u32)-1;
+
+    if (b->str != NULL && arenaExtend(b->arena, b->str + b->cap, cap - b->cap))
+    {
+        b->cap = cap;
+        return true;
+    }
+
+    char *str = ArenaAlloc(b->arena, cap);
+    if (str == NULL)
+    {
+        b->err = ERR_NO_MEMORY;
+        return false;
+    }
+
+    memcpy(str, b->str, b->length);
+    b->str = str;
+    b->cap = cap;
+    return true;
+}
+
+static void sbWrite(StrBuilder *b, const char *s, u32 n)
+{
+    if (!sbReserve(b, n))
+        return;
+    memcpy(b->str + b->length, s, n);
+    b->length += n;
+}
+
+static void sbFill(StrBuilder *b, char c, u32 n)
+{
+    if (!sbReserve(b, n))
+        return;
+    memset(b->str + b->length, c, n);
+    b->length += n;
+}
+
+// Writes s right aligned in width, or left aligned if pad is '-'. Zero
+// padding goes after the sign.
+static void sbPadded(StrBuilder *b, const char *s, u32 n, u32 width, char pad)
+{
+    if (n >= width)
+    {
+        sbWrite(b, s, n);
+        return;
+    }
+
+    if (pad == '-')
+    {
+        sbWrite(b, s, n);
+        sbFill(b, ' ', width - n);
+        return;
+    }
+
+    if (pad == '0' && n > 0 && s[0] == '-')
+    {
+        sbWrite(b, s, 1);
+        s++, n--, width--;
+    }
+    sbFill(b, pad, width - n);
+    sbWrite(b, s, n);
+}
+
+static const char digitPairs[] = "00010203040506070809"
+                                 "10111213141516171819"
+                                 "20212223242526272829"
+                                 "30313233343536373839"
+                                 "40414243444546474849"
+                                 "50515253545556575859"
+                                 "60616263646566676869"
+                                 "70717273747576777879"
+                                 "80818283848586878889"
+                                 "90919293949596979899";
+
+// Writes the decimal digits of v backwards, two at a time, ending at end.
+// Returns pointer to the first digit.
+static char *formatU64(char *end, u64 v)
+{
+    while (v >= 100)
+    {
+        u64 q = v / 100;
+        end -= 2;
+        memcpy(end, digitPairs + (v - q * 100) * 2, 2);
+        v = q;
+    }
+
+    if (v >= 10)
+    {
+        end -= 2;
+        memcpy(end, digitPairs + v * 2, 2);
+    }
+    else
+        *--end = '0' + (char)v;
+    return end;
+}
+
+static char *formatI64(char *end, i64 v)
+{
+    char *p = formatU64(end, v < 0 ? 0 - (u64)v : (u64)v);
+    if (v < 0)
+        *--p = '-';
+    return p;
+}
+
+static char *formatHex(char *end, u64 v, bool upper)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do
+    {
+        *--end = digits[v & 15];
+        v >>= 4;
+    } while (v);
+    return end;
+}
+
+// Powers of ten that are exact doubles
+static const f64 pow10Table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+#define FLOAT_MAX_DECIMALS 17
+
+// Formats v with a fixed number of decimals, rounding half up. Values whose
+// integer part does not fit in a u64 go through snprintf.
+static void sbFloat(StrBuilder *b, f64 v, u32 decimals, u32 width, char pad)
+{
+    char buf[48];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+
+    if (v != v)
+    {
+        sbPadded(b, "nan", 3, width, pad == '0' ? ' ' : pad);
+        return;
+    }
+
+    bool neg = v < 0;
+    f64 mag = neg ? -v : v;
+
+    if (mag - mag != 0)
+    {
+        sbPadded(b, neg ? "-inf" : "inf", neg ? 4 : 3, width, pad == '0' ? ' ' : pad);
+        return;
+    }
+
+    if (mag >= 1e18 || decimals > FLOAT_MAX_DECIMALS)
+    {
+        int n = snprintf(NULL, 0, "%.*f", decimals, v);
+        if (n < 0)
+            return;
+        u32 fill = (u32)n < width ? width - n : 0;
+        if (!sbReserve(b, (u64)n + fill + 1))
+            return;
+
+        // Printed at the end of the builder, then padded in place like sbPadded
+        char *s = b->str + b->length;
+        snprintf(s, n + 1, "%.*f", decimals, v);
+        if (pad == '-')
+            memset(s + n, ' ', fill);
+        else
+        {
+            u32 sign = pad == '0' && s[0] == '-';
+            memmove(s + sign + fill, s + sign, n - sign);
+            memset(s + sign, pad, fill);
+        }
+        b->length += n + fill;
+        return;
+    }
+
+    u64 scale = (u64)pow10Table[decimals];
+    u64 whole = (u64)mag;
+    u64 frac = (u64)((mag - (f64)whole) * (f64)scale + 0.5);
+    if (frac >= scale)
+    {
+        whole++;
+        frac -= scale;
+    }
+
+    if (decimals > 0)
+    {
+        for (u32 i = 0; i < decimals; i++)
+        {
+            *--p = '0' + frac % 10;
+            frac /= 10;
+        }
+        *--p = '.';
+    }
+
+    p = formatU64(p, whole);
+    if (neg)
+        *--p = '-';
+    sbPadded(b, p, end - p, width, pad);
+}
+
+void StrBuilderAppend(StrBuilder *b, String s)
+{
+    if (b == NULL)
+        return;
+    if (!Ok(s))
+    {
+        b->err = s.err;
+        return;
+    }
+    sbWrite(b, s.str, s.length);
+}
+
+void StrBuilderAppendChar(StrBuilder *b, char c)
+{
+    if (b != NULL)
+        sbWrite(b, &c, 1);
+}
+
+void StrBuilderAppendInt(StrBuilder *b, i64 v)
+{
+    if (b == NULL)
+        return;
+
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *p = formatI64(end, v);
+    sbWrite(b, p, end - p);
+}
+
+void StrBuilderAppendFloat(StrBuilder *b, f64 v, u32 decimals)
+{
+    if (b != NULL)
+        sbFloat(b, v, decimals, 0, ' ');
+}
+
+void StrBuilderAppendf(StrBuilder *b, const char *fmt, ...)
+{
+    if (b == NULL || fmt == NULL)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+
+    const char *f = fmt;
+    while (*f && Ok(*b))
+    {
+        const char *start = f;
+        while (*f && *f != '%')
+            f++;
+        if (f > start)
+            sbWrite(b, start, f - start);
+        if (*f == 0)
+            break;
+
+        const char *spec = f++;
+        char pad = ' ';
+        u32 width = 0;
+        int precision = -1;
+        int longs = 0;
+        bool sized = false;
+
+        for (; *f == '-' || *f == '0'; f++)
+            pad = *f == '-' || pad == '-' ? '-' : '0';
+        if (*f == '*')
+        {
+            int w = va_arg(args, int);
+            pad = w < 0 ? '-' : pad;
+            width = w < 0 ? -w : w;
+            f++;
+        }
+        while (*f >= '0' && *f <= '9')
+            width = width * 10 + (*f++ - '0');
+        if (*f == '.')
+        {
+            precision = 0;
+            f++;
+            if (*f == '*')
+            {
+                precision = va_arg(args, int);
+                f++;
+            }
+            while (*f >= '0' && *f <= '9')
+                precision = precision * 10 + (*f++ - '0');
+        }
+        while (*f == 'l')
+        {
+            longs++;
+            f++;
+        }
+        if (*f == 'z')
+        {
+            sized = true;
+            f++;
+        }
+
+        char buf[24];
+        char *end = buf + sizeof(buf);
+        char *p;
+
+        switch (*f)
+        {
+        case 'd':
+        case 'i':
+        {
+            i64 v = sized ? (i64)va_arg(args, size_t) : longs >= 2 ? va_arg(args, long long) : longs == 1 ? va_arg(args, long) : va_arg(args, int);
+            p = formatI64(end, v);
+            sbPadded(b, p, end - p, width, pad);
+            break;
+        }
+        case 'u':
+        case 'x':
+        case 'X':
+        {
+            u64 v = sized ? va_arg(args, size_t) : longs >= 2 ? va_arg(args, unsigned long long) : longs == 1 ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+            p = *f == 'u' ? formatU64(end, v) : formatHex(end, v, *f == 'X');
+            sbPadded(b, p, end - p, width, pad);
+            break;
+        }
+        case 'f':
+            sbFloat(b, va_arg(args, f64), precision < 0 ? 6 : precision, width, pad);
+            break;
+        case 'c':
+            buf[0] = (char)va_arg(args, int);
+            sbPadded(b, buf, 1, width, pad == '-' ? '-' : ' ');
+            break;
+        case 's':
+        {
+            const char *s = va_arg(args, const char *);
+            if (s == NULL)
+                s = "(null)";
+            u32 n = precision < 0 ? strlen(s) : strnlen(s, precision);
+            sbPadded(b, s, n, width, pad == '-' ? '-' : ' ');
+            break;
+        }
+        case 'S':
+        {
+            String s = va_arg(args, String);
+            if (!Ok(s))
+                b->err = s.err;
+            else
+                sbPadded(b, s.str, s.length, width, pad == '-' ? '-' : ' ');
+            break;
+        }
+        case '%':
+            sbWrite(b, "%", 1);
+            break;
+        default:
+            // Unknown conversion, keep it as written
+            if (*f == 0)
+                f--;
+            sbWrite(b, spec, f - spec + 1);
+            break;
+        }
+        f++;
+    }
+
+    va_end(args);
+}
+
+String StrBuilderFinish(StrBuilder *b)
+{
+    if (b == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    if (!Ok(*b))
+        return (String){.err = b->err};
+
+    // Give unused capacity back if nothing was allocated after the builder
+    Arena *a = b->arena;
+    if (a->kind != ARENA_SHARED && (char *)a->memory + a->pos == b->str + b->cap)
+    {
+        a->pos -= b->cap - b->length;
+        b->cap = b->length;
+    }
+
+    return (String){
+        .err = ERR_NO_ERROR,
+        .str = b->str,
+        .length = b->length,
+    };
+}
+
+// True if all 8 bytes of chunk are ASCII digits
+static bool isEightDigits(u64 chunk)
+{
+    return ((chunk & 0xf0f0f0f0f0f0f0f0ull) | (((chunk + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4)) ==
+           0x3333333333333333ull;
+}
+
+// Returns value of 8 ASCII digits loaded little endian, first digit most
+// significant. Combines pairs, then quads, then the two halves with three
+// multiplies instead of eight.
+static u32 parseEightDigits(u64 chunk)
+{
+    const u64 mask = 0x000000ff000000ffull;
+    const u64 mul1 = 100 + (1000000ull << 32);
+    const u64 mul2 = 1 + (10000ull << 32);
+
+    chunk -= 0x3030303030303030ull;
+    chunk = (chunk * 10) + (chunk >> 8);
+    return (u32)((((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32);
+}
+
+static u64 loadU64(const char *p)
+{
+    u64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Parses the decimal digits of p, all n bytes must be digits.
+static u64 parseDigits(const char *p, u32 n, error *err)
+{
+    if (n == 0)
+    {
+        *err = ERR_PARSE_INVALID;
+        return 0;
+    }
+
+    // Leading zeros do not count towards overflow
+    while (n > 1 && *p == '0')
+        p++, n--;
+
+    // Up to 19 digits always fit in a u64
+    u64 v = 0;
+    u32 i = 0;
+    for (; i + 8 <= n && i + 8 <= 16; i += 8)
+    {
+        u64 chunk = loadU64(p + i);
+        if (!isEightDigits(chunk))
+            break;
+        v = v * 100000000 + parseEightDigits(chunk);
+    }
+
+    bool overflow = false;
+    for (; i < n; i++)
+    {
+        u8 d = p[i] - '0';
+        if (d > 9)
+        {
+            *err = ERR_PARSE_INVALID;
+            return 0;
+        }
+        if (i >= 19 && v > ((u64)-1 - d) / 10)
+            overflow = true;
+        v = v * 10 + d;
+    }
+
+    if (overflow)
+        *err = ERR_PARSE_OVERFLOW;
+    return overflow ? 0 : v;
+}
+
+ParsedU64 StrToU64(String s)
+{
+    if (!Ok(s))
+        return (ParsedU64){.err = s.err};
+
+    const char *p = s.str;
+    u32 n = s.length;
+    if (n > 0 && *p == '+')
+        p++, n--;
+
+    error err = ERR_NO_ERROR;
+    u64 v = parseDigits(p, n, &err);
+    return (ParsedU64){.value = err ? 0 : v, .err = err};
+}
+
+ParsedI64 StrToI64(String s)
+{
+    if (!Ok(s))
+        return (ParsedI64){.err = s.err};
+
+    const char *p = s.str;
+    u32 n = s.length;
+    bool neg = n > 0 && *p == '-';
+    if (n > 0 && (*p == '-' || *p == '+'))
+        p++, n--;
+
+    error err = ERR_NO_ERROR;
+    u64 mag = parseDigits(p, n, &err);
+    if (err)
+        return (ParsedI64){.err = err};
+    if (mag > (neg ? (u64)1 << 63 : ((u64)1 << 63) - 1))
+        return (ParsedI64){.err = ERR_PARSE_OVERFLOW};
+
+    return (ParsedI64){
+        .value = neg ? (i64)(0 - mag) : (i64)mag,
+        .err = ERR_NO_ERROR,
+    };
+}
+
+ParsedU64 StrHexToU64(String s)
+{
+    if (!Ok(s))
+        return (ParsedU64){.err = s.err};
+
+    const char *p = s.str;
+    u32 n = s.length;
+    if (n >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        p += 2, n -= 2;
+    if (n == 0)
+        return (ParsedU64){.err = ERR_PARSE_INVALID};
+
+    while (n > 1 && *p == '0')
+        p++, n--;
+
+    u64 v = 0;
+    for (u32 i = 0; i < n; i++)
+    {
+        u8 c = p[i];
+        u8 d = c - '0';
+        if (d > 9)
+        {
+            // Lower case letters and map a-f to 10-15
+            d = (c | 0x20) - 'a' + 10;
+            if (d < 10 || d > 15)
+                return (ParsedU64){.err = ERR_PARSE_INVALID};
+        }
+        v = (v << 4) | d;
+    }
+
+    if (n > 16)
+        return (ParsedU64){.err = ERR_PARSE_OVERFLOW};
+    return (ParsedU64){.value = v, .err = ERR_NO_ERROR};
+}
+
+// Significant digits kept by StrToF64, the most a u64 always holds
+#define FLOAT_MAX_DIGITS 19
+
+// Accumulates the digits at p into w. Returns the number of digits read.
+// Digits past the first FLOAT_MAX_DIGITS are counted in dropped, and set
+// truncated if any of them is not zero.
+static u32 floatDigits(const char *p, u32 n, u64 *w, u32 *sig, u32 *dropped, bool *truncated)
+{
+    u32 i = 0;
+    while (i + 8 <= n && *sig + 8 <= FLOAT_MAX_DIGITS)
+    {
+        u64 chunk = loadU64(p + i);
+        if (!isEightDigits(chunk))
+            break;
+        *w = *w * 100000000 + parseEightDigits(chunk);
+        *sig += 8;
+        i += 8;
+    }
+
+    for (; i < n && (u8)(p[i] - '0') <= 9; i++)
+    {
+        if (*sig < FLOAT_MAX_DIGITS)
+        {
+            *w = *w * 10 + (p[i] - '0');
+            (*sig)++;
+        }
+        else
+        {
+            (*dropped)++;
+            *truncated |= p[i] != '0';
+        }
+    }
+
+    return i;
+}
+
+// Parses s with strtod, for values the fast path cannot round correctly.
+// strtod expects the decimal point of the current locale, so '.' is replaced
+// with it first.
+static ParsedF64 parseFloatSlow(const char *p, u32 n)
+{
+    const char *point = localeconv()->decimal_point;
+    if (point == NULL || point[0] == 0)
+        point = ".";
+    u64 pointLength = strlen(point);
+
+    char small[64];
+    u64 size = (u64)n + pointLength + 1;
+    char *buf = size <= sizeof(small) ? small : xdefaultAlloc(size);
+    if (buf == NULL)
+        return (ParsedF64){.err = ERR_NO_MEMORY};
+
+    u64 length = 0;
+    for (u32 i = 0; i < n; i++)
+    {
+        if (p[i] == '.')
+        {
+            memcpy(buf + length, point, pointLength);
+            length += pointLength;
+        }
+        else
+            buf[length++] = p[i];
+    }
+    buf[length] = 0;
+
+    errno = 0;
+    char *end;
+    f64 v = strtod(buf, &end);
+    bool complete = end == buf + length;
+    bool overflow = errno == ERANGE && (v == HUGE_VAL || v == -HUGE_VAL);
+
+    if (buf != small)
+        xdefaultFree(buf);
+    if (!complete)
+        return (ParsedF64){.err = ERR_PARSE_INVALID};
+    if (overflow)
+        return (ParsedF64){.err = ERR_PARSE_OVERFLOW};
+    return (ParsedF64){.value = v, .err = ERR_NO_ERROR};
+}
+
+// Returns true if p is word, ignoring ASCII case
+static bool equalsWordNoCase(const char *p, u32 n, const char *word)
+{
+    if (n != strlen(word))
+        return false;
+    for (u32 i = 0; i < n; i++)
+        if ((p[i] | 0x20) != word[i])
+            return false;
+    return true;
+}
+
+ParsedF64 StrToF64(String s)
+{
+    if (!Ok(s))
+        return (ParsedF64){.err = s.err};
+
+    const char *p = s.str;
+    u32 n = s.length;
+    u32 i = 0;
+    bool neg = n > 0 && p[0] == '-';
+    if (n > 0 && (p[0] == '-' || p[0] == '+'))
+        i++;
+
+    if (equalsWordNoCase(p + i, n - i, "inf") || equalsWordNoCase(p + i, n - i, "infinity"))
+        return (ParsedF64){.value = neg ? -HUGE_VAL : HUGE_VAL};
+    if (equalsWordNoCase(p + i, n - i, "nan"))
+        return (ParsedF64){.value = neg ? -NAN : NAN};
+
+    u64 w = 0;
+    u32 sig = 0, dropped = 0, digits = 0;
+    bool truncated = false;
+    i64 exp10 = 0;
+
+    // Integer part, leading zeros are not significant
+    u32 start = i;
+    while (i < n && p[i] == '0')
+        i++;
+    i += floatDigits(p + i, n - i, &w, &sig, &dropped, &truncated);
+    exp10 += dropped;
+    digits += i - start;
+
+    if (i < n && p[i] == '.')
+    {
+        i++;
+        start = i;
+        if (w == 0)
+        {
+            while (i < n && p[i] == '0')
+                i++, exp10--;
+        }
+
+        dropped = 0;
+        u32 read = floatDigits(p + i, n - i, &w, &sig, &dropped, &truncated);
+        exp10 -= read - dropped;
+        i += read;
+        digits += i - start;
+    }
+
+    if (digits == 0)
+        return (ParsedF64){.err = ERR_PARSE_INVALID};
+
+    if (i < n && (p[i] == 'e' || p[i] == 'E'))
+    {
+        i++;
+        bool expNeg = i < n && p[i] == '-';
+        if (i < n && (p[i] == '-' || p[i] == '+'))
+            i++;
+        if (i == n)
+            return (ParsedF64){.err = ERR_PARSE_INVALID};
+
+        i64 e = 0;
+        for (; i < n && (u8)(p[i] - '0') <= 9; i++)
+            if (e < 100000)
+                e = e * 10 + (p[i] - '0');
+        exp10 += expNeg ? -e : e;
+    }
+
+    if (i != n)
+        return (ParsedF64){.err = ERR_PARSE_INVALID};
+
+    if (w == 0)
+        return (ParsedF64){.value = neg ? -0.0 : 0.0};
+
+    // Clinger fast path. The mantissa and power of ten are exact doubles, so
+    // one multiply or divide rounds correctly.
+    const u64 maxExact = (u64)1 << 53;
+    if (!truncated && w <= maxExact && exp10 >= -22 && exp10 <= 22 + 15)
+    {
+        f64 v;
+        if (exp10 < 0)
+            v = (f64)w / pow10Table[-exp10];
+        else if (exp10 <= 22)
+            v = (f64)w * pow10Table[exp10];
+        else
+        {
+            // Move the excess power into the mantissa while it stays exact
+            u64 scaled = w;
+            for (i64 k = exp10; k > 22 && scaled <= maxExact; k--)
+                scaled *= 10;
+            if (scaled > maxExact)
+                return parseFloatSlow(p, n);
+            v = (f64)scaled * pow10Table[22];
+        }
+        return (ParsedF64){.value = neg ? -v : v};
+    }
+
+    return parseFloatSlow(p, n);
+}
+
+bool StrCompare(String a, String b)
+{
+    if (!Ok(a) || !Ok(b))
+        return false;
+    if (a.length != b.length)
+        return false;
+    return memcmp(a.str, b.str, a.length) == 0;
+}
+
+// StrHash is based on wyhash by Wang Yi, which is public domain
+
+static const u64 wySecret[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+// Sets a and b to the low and high halves of a * b
+static inline void wyMultiply(u64 *a, u64 *b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (u64)r;
+    *b = (u64)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    u64 ha = *a >> 32, hb = *b >> 32, la = (u32)*a, lb = (u32)*b;
+    u64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    u64 t = rl + (rm0 << 32);
+    u64 c = t < rl;
+    u64 lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline u64 wyMix(u64 a, u64 b)
+{
+    wyMultiply(&a, &b);
+    return a ^ b;
+}
+
+static inline u64 wyRead8(const u8 *p)
+{
+    u64 v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline u64 wyRead4(const u8 *p)
+{
+    u32 v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static u64 wyHash(const u8 *p, u64 length, u64 seed)
+{
+    seed ^= wyMix(seed ^ wySecret[0], wySecret[1]);
+    u64 a, b;
+
+    if (length <= 16)
+    {
+        if (length >= 4)
+        {
+            a = (wyRead4(p) << 32) | wyRead4(p + ((length >> 3) << 2));
+            b = (wyRead4(p + length - 4) << 32) | wyRead4(p + length - 4 - ((length >> 3) << 2));
+        }
+        else if (length > 0)
+        {
+            a = ((u64)p[0] << 16) | ((u64)p[length >> 1] << 8) | p[length - 1];
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else
+    {
+        u64 i = length;
+        if (i > 48)
+        {
+            u64 see1 = seed, see2 = seed;
+            do
+            {
+                seed = wyMix(wyRead8(p) ^ wySecret[1], wyRead8(p + 8) ^ seed);
+                see1 = wyMix(wyRead8(p + 16) ^ wySecret[2], wyRead8(p + 24) ^ see1);
+                see2 = wyMix(wyRead8(p + 32) ^ wySecret[3], wyRead8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16)
+        {
+            seed = wyMix(wyRead8(p) ^ wySecret[1], wyRead8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyRead8(p + i - 16);
+        b = wyRead8(p + i - 8);
+    }
+
+    a ^= wySecret[1];
+    b ^= seed;
+    wyMultiply(&a, &b);
+    return wyMix(a ^ wySecret[0] ^ length, b ^ wySecret[1]);
+}
+
+u64 StrHash(String s)
+{
+    if (!Ok(s))
+        return 0;
+    return wyHash((const u8 *)s.str, s.length, 0);
+}
+
+HString StrHashed(String s)
+{
+    return (HString){
+        .s = s,
+        .hash = StrHash(s),
+    };
+}
+
+bool StrHashedCompare(HString a, HString b)
+{
+    if (a.hash != b.hash)
+        return false;
+    return StrCompare(a.s, b.s);
+}
+
+// Map is a Swiss table: slots are split in groups of 16, and each group's
+// control bytes are matched against the hash at once
+
+#define MAP_GROUP_SIZE 16
+#define MAP_MAX_CAP (1u << 31)
+#define MAP_EMPTY 0x80
+#define MAP_DELETED 0xfe
+
+// Returns bitmask of control bytes in group equal to b.
+static inline u32 mapMatch(const u8 *group, u8 b)
+{
+#ifdef LIBX_SIMD_X86
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b)));
+#else
+    u32 mask = 0;
+    for (int i = 0; i < MAP_GROUP_SIZE; i++)
+        mask |= (u32)(group[i] == b) << i;
+    return mask;
+#endif
+}
+
+// Returns bitmask of empty and deleted control bytes, which are the only ones
+// with the high bit set.
+static inline u32 mapMatchFree(const u8 *group)
+{
+#ifdef LIBX_SIMD_X86
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    u32 mask = 0;
+    for (int i = 0; i < MAP_GROUP_SIZE; i++)
+        mask |= (u32)(group[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+static inline u64 mapHashU64(u64 key)
+{
+    return wyMix(key ^ wySecret[0], wySecret[1]);
+}
+
+#define mapKeySize(m) ((m)->stringKeys ? sizeof(HString) : sizeof(u64))
+#define mapValue(m, slot) ((char *)(m)->values + (u64)(slot) * (m)->valueSize)
+
+static bool mapAllocate(Map *m, u32 cap)
+{
+    u64 keysOffset = alignUp(cap, ARENA_ALIGN);
+    u64 valuesOffset = alignUp(keysOffset + (u64)cap * mapKeySize(m), ARENA_ALIGN);
+    char *memory = ArenaAllocAligned(m->arena, valuesOffset + (u64)cap * m->valueSize, ARENA_ALIGN);
+    if (memory == NULL)
+        return false;
+
+    memset(memory, MAP_EMPTY, cap);
+    m->ctrl = (u8 *)memory;
+    m->keys = memory + keysOffset;
+    m->values = memory + valuesOffset;
+    m->cap = cap;
+    m->count = 0;
+    m->deleted = 0;
+    return true;
+}
+
+static Map mapNew(Arena *a, u32 valueSize, u32 cap, bool stringKeys)
+{
+    if (a == NULL)
+        return (Map){.err = ERR_NULL_PTR};
+    if (!Ok(*a))
+        return (Map){.err = a->err};
+
+    Map m = {
+        .arena = a,
+        .valueSize = valueSize,
+        .stringKeys = stringKeys,
+    };
+
+    // Room for cap items below the maximum load of 7/8
+    u64 slots = MAP_GROUP_SIZE;
+    while (slots / 8 * 7 < cap)
+        slots *= 2;
+    if (slots > MAP_MAX_CAP)
+        return (Map){.err = ERR_NO_MEMORY};
+
+    if (!mapAllocate(&m, (u32)slots))
+        return (Map){.err = a->err};
+    return m;
+}
+
+Map MapNew(Arena *a, u32 valueSize, u32 cap)
+{
+    return mapNew(a, valueSize, cap, true);
+}
+
+Map MapNewU64(Arena *a, u32 valueSize, u32 cap)
+{
+    return mapNew(a, valueSize, cap, false);
+}
+
+static inline bool mapKeyEqual(Map *m, u32 slot, const void *key, u64 hash)
+{
+    if (m->stringKeys)
+    {
+        HString *k = (HString *)m->keys + slot;
+        return k->hash == hash && StrCompare(k->s, *(const String *)key);
+    }
+    return ((u64 *)m->keys)[slot] == *(const u64 *)key;
+}
+
+// Returns slot of key, or -1 if not found.
+static u32 mapFind(Map *m, const void *key, u64 hash)
+{
+    u32 groups = m->cap / MAP_GROUP_SIZE;
+    u32 group = (hash >> 7) & (groups - 1);
+    u8 h2 = hash & 0x7f;
+
+    // Triangular probing visits every group once
+    for (u32 step = 1; step <= groups; step++)
+    {
+        const u8 *ctrl = m->ctrl + group * MAP_GROUP_SIZE;
+        for (u32 mask = mapMatch(ctrl, h2); mask; mask &= mask - 1)
+        {
+            u32 slot = group * MAP_GROUP_SIZE + xctz(mask);
+            if (mapKeyEqual(m, slot, key, hash))
+                return slot;
+        }
+
+        if (mapMatch(ctrl, MAP_EMPTY))
+            return -1;
+        group = (group + step) & (groups - 1);
+    }
+    return -1;
+}
+
+// Returns first empty or deleted slot for hash. The map always has one.
+static u32 mapFindFree(Map *m, u64 hash)
+{
+    u32 groups = m->cap / MAP_GROUP_SIZE;
+    u32 group = (hash >> 7) & (groups - 1);
+
+    for (u32 step = 1;; step++)
+    {
+        u32 mask = mapMatchFree(m->ctrl + group * MAP_GROUP_SIZE);
+        if (mask)
+            return group * MAP_GROUP_SIZE + xctz(mask);
+        group = (group + step) & (groups - 1);
+    }
+}
+
+static inline u64 mapSlotHash(Map *m, u32 slot)
+{
+    if (m->stringKeys)
+        return ((HString *)m->keys)[slot].hash;
+    return mapHashU64(((u64 *)m->keys)[slot]);
+}
+
+static void mapSwap(char *a, char *b, u64 n)
+{
+    for (u64 i = 0; i < n; i++)
+    {
+        char t = a[i];
+        a[i] = b[i];
+        b[i] = t;
+    }
+}
+
+// Drops all tombstones without allocating. Items are first marked deleted,
+// then each is moved to the first free slot of its probe sequence, or kept
+// if that is in its own group. Moving onto another unplaced item swaps the
+// two, and the swapped in item is placed next.
+static void mapRehashInPlace(Map *m)
+{
+    for (u32 slot = 0; slot < m->cap; slot++)
+        m->ctrl[slot] = m->ctrl[slot] & 0x80 ? MAP_EMPTY : MAP_DELETED;
+
+    u64 keySize = mapKeySize(m);
+    for (u32 slot = 0; slot < m->cap; slot++)
+    {
+        while (m->ctrl[slot] == MAP_DELETED)
+        {
+            u64 hash = mapSlotHash(m, slot);
+            u32 dst = mapFindFree(m, hash);
+            if (dst / MAP_GROUP_SIZE == slot / MAP_GROUP_SIZE)
+            {
+                m->ctrl[slot] = hash & 0x7f;
+                break;
+            }
+
+            if (m->ctrl[dst] == MAP_EMPTY)
+                m->ctrl[slot] = MAP_EMPTY;
+            m->ctrl[dst] = hash & 0x7f;
+            mapSwap((char *)m->keys + slot * keySize, (char *)m->keys + dst * keySize, keySize);
+            mapSwap(mapValue(m, slot), mapValue(m, dst), m->valueSize);
+        }
+    }
+    m->deleted = 0;
+}
+
+// Moves all items into new arrays of cap slots, or only drops tombstones if cap
+// is unchanged. Old arrays stay in the arena.
+static bool mapRehash(Map *m, u32 cap)
+{
+    if (cap == m->cap)
+    {
+        mapRehashInPlace(m);
+        return true;
+    }
+
+    Map old = *m;
+    if (!mapAllocate(m, cap))
+    {
+        *m = old;
+        return false;
+    }
+
+    u64 keySize = mapKeySize(m);
+    for (u32 slot = 0; slot < old.cap; slot++)
+    {
+        if (old.ctrl[slot] & 0x80)
+            continue;
+
+        u64 hash = mapSlotHash(&old, slot);
+        u32 dst = mapFindFree(m, hash);
+        m->ctrl[dst] = hash & 0x7f;
+        memcpy((char *)m->keys + dst * keySize, (char *)old.keys + slot * keySize, keySize);
+        memcpy(mapValue(m, dst), mapValue(&old, slot), m->valueSize);
+        m->count++;
+    }
+    return true;
+}
+
+static void *mapGet(Map *m, const void *key, u64 hash)
+{
+    if (m == NULL || !Ok(*m))
+        return NULL;
+
+    u32 slot = mapFind(m, key, hash);
+    return slot == (u32)-1 ? NULL : mapValue(m, slot);
+}
+
+static void *mapPut(Map *m, const void *key, u64 hash)
+{
+    if (m == NULL || !Ok(*m))
+        return NULL;
+
+    u32 slot = mapFind(m, key, hash);
+    if (slot != (u32)-1)
+        return mapValue(m, slot);
+
+    // Grow when full, or clean up in place when mostly tombstones
+    if (m->count + m->deleted + 1 > m->cap / 8 * 7)
+    {
+        bool grow = m->count + 1 > m->cap / 2;
+        if ((grow && m->cap >= MAP_MAX_CAP) || !mapRehash(m, grow ? m->cap * 2 : m->cap))
+        {
+            m->err = ERR_NO_MEMORY;
+            return NULL;
+        }
+    }
+
+    slot = mapFindFree(m, hash);
+    if (m->ctrl[slot] == MAP_DELETED)
+        m->deleted--;
+    m->ctrl[slot] = hash & 0x7f;
+    m->count++;
+
+    if (m->stringKeys)
+        ((HString *)m->keys)[slot] = (HString){.s = *(const String *)key, .hash = hash};
+    else
+        ((u64 *)m->keys)[slot] = *(const u64 *)key;
+
+    void *value = mapValue(m, slot);
+    memset(value, 0, m->valueSize);
+    return value;
+}
+
+static bool mapDelete(Map *m, const void *key, u64 hash)
+{
+    if (m == NULL || !Ok(*m))
+        return false;
+
+    u32 slot = mapFind(m, key, hash);
+    if (slot == (u32)-1)
+        return false;
+
+    // A group with an empty slot never continued a probe, so it does not
+    // need a tombstone
+    u8 *group = m->ctrl + slot / MAP_GROUP_SIZE * MAP_GROUP_SIZE;
+    if (mapMatch(group, MAP_EMPTY))
+        m->ctrl[slot] = MAP_EMPTY;
+    else
+    {
+        m->ctrl[slot] = MAP_DELETED;
+        m->deleted++;
+    }
+    m->count--;
+    return true;
+}
+
+void *MapGet(Map *m, String key)
+{
+    if (m == NULL || !m->stringKeys || !Ok(key))
+        return NULL;
+    return mapGet(m, &key, StrHash(key));
+}
+
+void *MapPut(Map *m, String key)
+{
+    if (m == NULL || !m->stringKeys || !Ok(key))
+        return NULL;
+    return mapPut(m, &key, StrHash(key));
+}
+
+bool MapDelete(Map *m, String key)
+{
+    if (m == NULL || !m->stringKeys || !Ok(key))
+        return false;
+    return mapDelete(m, &key, StrHash(key));
+}
+
+void *MapGetU64(Map *m, u64 key)
+{
+    if (m == NULL || m->stringKeys)
+        return NULL;
+    return mapGet(m, &key, mapHashU64(key));
+}
+
+void *MapPutU64(Map *m, u64 key)
+{
+    if (m == NULL || m->stringKeys)
+        return NULL;
+    return mapPut(m, &key, mapHashU64(key));
+}
+
+bool MapDeleteU64(Map *m, u64 key)
+{
+    if (m == NULL || m->stringKeys)
+        return false;
+    return mapDelete(m, &key, mapHashU64(key));
+}
+
+Interner InternerNew(Arena *a, u32 cap)
+{
+    if (a == NULL)
+        return (Interner){.err = ERR_NULL_PTR};
+    if (!Ok(*a))
+        return (Interner){.err = a->err};
+
+    if (cap == 0)
+        cap = 16;
+
+    Interner in = {
+        .arena = a,
+        .ids = MapNew(a, sizeof(u32), cap),
+        .strings = ArenaPushArray(a, String, cap),
+        .cap = cap,
+    };
+    if (!Ok(in.ids) || in.strings == NULL)
+        return (Interner){.err = ERR_NO_MEMORY};
+    return in;
+}
+
+u32 StrInternId(Interner *in, String s)
+{
+    if (in == NULL || !Ok(*in) || !Ok(s))
+        return -1;
+
+    // Hash once for both the lookup and the insert
+    u64 hash = StrHash(s);
+    u32 slot = mapFind(&in->ids, &s, hash);
+    if (slot != (u32)-1)
+        return *(u32 *)mapValue(&in->ids, slot);
+
+    if (in->count == in->cap)
+    {
+        String *strings = ArenaPushArray(in->arena, String, (u64)in->cap * 2);
+        if (strings == NULL)
+        {
+            in->err = ERR_NO_MEMORY;
+            return -1;
+        }
+        memcpy(strings, in->strings, sizeof(String) * in->count);
+        in->strings = strings;
+        in->cap *= 2;
+    }
+
+    // The map keeps the copy as key, so it never points into caller memory
+    String copy = StrCopy(in->arena, s);
+    u32 *id = Ok(copy) ? mapPut(&in->ids, &copy, hash) : NULL;
+    if (id == NULL)
+    {
+        in->err = ERR_NO_MEMORY;
+        return -1;
+    }
+
+    *id = in->count;
+    in->strings[in->count] = copy;
+    return in->count++;
+}
+
+String StrIntern(Interner *in, String s)
+{
+    u32 id = StrInternId(in, s);
+    if (id == (u32)-1)
+        return (String){.err = in == NULL ? ERR_NULL_PTR : Ok(s) ? in->err : s.err};
+    return in->strings[id];
+}
+
+String InternerGet(Interner *in, u32 id)
+{
+    if (in == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    if (!Ok(*in))
+        return (String){.err = in->err};
+    if (id >= in->count)
+        return (String){.err = ERR_NULL_PTR};
+    return in->strings[id];
+}
+
+CsvReader CsvNew(Arena *a, char *data, u64 size, char delim)
+{
+    if (a == NULL || (data == NULL && size > 0))
+        return (CsvReader){.err = ERR_NULL_PTR};
+    if (delim == '"' || delim == '\n' || delim == '\r')
+        return (CsvReader){.err = ERR_PARSE_INVALID};
+
+    String *fields = ListCreateArena(a, sizeof(String), 16);
+    if (fields == NULL)
+        return (CsvReader){.err = ERR_NO_MEMORY};
+
+    return (CsvReader){
+        .data = data,
+        .size = size,
+        .pos = 0,
+        .delim = delim,
+        .fields = fields,
+        .row = 0,
+        .err = ERR_NO_ERROR,
+    };
+}
+
+// Returns bitmap of delimiters, newlines and quotes in the n bytes at p, up
+// to 64. Bit i is set if p[i] is one of them.
+static u64 csvStructural(const char *p, u32 n, char delim)
+{
+    u64 mask = 0;
+    u32 i = 0;
+#ifdef LIBX_SIMD_X86
+    if (n == 64)
+    {
+        __m128i d = _mm_set1_epi8(delim);
+        __m128i nl = _mm_set1_epi8('\n');
+        __m128i q = _mm_set1_epi8('"');
+        for (; i < 64; i += 16)
+        {
+            __m128i c = _mm_loadu_si128((const __m128i *)(p + i));
+            __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, d), _mm_cmpeq_epi8(c, nl)), _mm_cmpeq_epi8(c, q));
+            mask |= (u64)(u16)_mm_movemask_epi8(m) << i;
+        }
+        return mask;
+    }
+#endif
+    for (; i < n; i++)
+        if (p[i] == delim || p[i] == '\n' || p[i] == '"')
+            mask |= (u64)1 << i;
+    return mask;
+}
+
+// Adds field from start to end to the row, without the trailing CR and the
+// quotes of a quoted field.
+static void csvField(CsvReader *r, u64 start, u64 end, bool quoted)
+{
+    if (end > start && r->data[end - 1] == '\r')
+        end--;
+    if (quoted)
+    {
+        start++;
+        if (end > start && r->data[end - 1] == '"')
+            end--;
+    }
+
+    pushv(r->fields, (String){.str = r->data + start, .length = end - start});
+}
+
+// Returns the finished row, or NULL if adding a field failed.
+static String *csvRow(CsvReader *r)
+{
+    if (listHeader(r->fields)->err)
+    {
+        r->err = ERR_NO_MEMORY;
+        return NULL;
+    }
+    return r->fields;
+}
+
+String *CsvNextRow(CsvReader *r)
+{
+    if (r == NULL)
+        return NULL;
+    if (!Ok(*r))
+        return NULL;
+    if (r->pos >= r->size)
+    {
+        r->err = ERR_ITERATION_FINISH;
+        return NULL;
+    }
+
+    listHeader(r->fields)->length = 0;
+
+    u64 start = r->pos;
+    u64 skip = (u64)-1; // Second quote of an escaped "" pair
+    bool inQuote = false;
+    bool quoted = false;
+
+    // Only structural characters are visited, the rest of each 64 byte block
+    // is skipped with one bit scan
+    for (u64 base = r->pos; base < r->size; base += 64)
+    {
+        u64 n = r->size - base < 64 ? r->size - base : 64;
+        u64 mask = csvStructural(r->data + base, n, r->delim);
+
+        while (mask)
+        {
+            u64 k = base + xctz64(mask);
+            mask &= mask - 1;
+            char c = r->data[k];
+
+            if (k == skip)
+                continue;
+
+            if (inQuote)
+            {
+                if (c != '"')
+                    continue;
+                if (k + 1 < r->size && r->data[k + 1] == '"')
+                    skip = k + 1;
+                else
+                    inQuote = false;
+                continue;
+            }
+
+            if (c == '"')
+            {
+                // Quotes only have meaning at the start of a field
+                if (k == start)
+                    inQuote = quoted = true;
+                continue;
+            }
+
+            csvField(r, start, k, quoted);
+            start = k + 1;
+            quoted = false;
+
+            if (c == '\n')
+            {
+                r->pos = k + 1;
+                r->row++;
+                return csvRow(r);
+            }
+        }
+    }
+
+    // Last row without a trailing newline
+    csvField(r, start, r->size, quoted);
+    r->pos = r->size;
+    r->row++;
+    return csvRow(r);
+}
+
+String CsvUnquote(Arena *a, String field)
+{
+    if (a == NULL)
+        return (String){.err = ERR_NULL_PTR};
+    returnIfError(field);
+
+    u32 first = StrFind(field, '"');
+    if (first == (u32)-1)
+        return field;
+
+    char *str = ArenaAlloc(a, field.length);
+    if (str == NULL)
+        return (String){.err = ERR_NO_MEMORY};
+
+    memcpy(str, field.str, first);
+    u32 length = first;
+    for (u32 i = first; i < field.length; i++)
+    {
+        str[length++] = field.str[i];
+        if (field.str[i] == '"' && i + 1 < field.length && field.str[i + 1] == '"')
+            i++;
+    }
+
+    return (String){
+        .err = ERR_NO_ERROR,
+        .str = str,
+        .length = length,
+    };
+}
+
+String *CsvSplitChunks(char *data, u64 size, u32 count)
+{
+    if (data == NULL || count == 0)
+        return NULL;
+
+    // Chunks are Strings, so each has to fit in a u32
+    while (size / count >= (u32)-1)
+        count++;
+
+    String *chunks = ListCreate(sizeof(String), count);
+    if (chunks == NULL)
+        return NULL;
+
+    u64 start = 0;
+    for (u32 i = 1; i <= count && start < size; i++)
+    {
+        u64 end = i == count ? size : size / count * i;
+        if (end < start)
+            end = start;
+
+        // Move the split past the next newline
+        if (end < size)
+        {
+            char *nl = memchr(data + end, '\n', size - end);
+            end = nl == NULL ? size : (u64)(nl - data) + 1;
+        }
+
+        if (end - start >= (u32)-1)
+        {
+            ListFree(chunks);
+            return NULL;
+        }
+
+        appendv(chunks, (String){.str = data + start, .length = end - start});
+        start = end;
+    }
+
+    return chunks;
+}
+
+typedef struct Job
+{
+    JobFunc fn;
+    void *arg;
+    JobCounter *counter;
+} Job;
+
+// Chase-Lev deque of one worker. The owner pushes and pops at bottom, other
+// threads steal from top. Workers start on a cache line of their own.
+typedef struct JobWorker
+{
+    _Alignas(CACHE_LINE_SIZE) volatile u64 top;
+    u8 _pad0[CACHE_LINE_SIZE - sizeof(u64)];
+    volatile u64 bottom;
+    u8 _pad1[CACHE_LINE_SIZE - sizeof(u64)];
+    Job jobs[JOB_QUEUE_SIZE];
+    struct JobState *state;
+    xthread thread;
+    u32 index;
+} JobWorker;
+
+typedef struct JobState
+{
+    JobWorker *workers;
+    void *workerMemory; // Allocation holding workers, which start at the next cache line
+    u32 count;
+
+    // Jobs submitted from threads that are not workers, or from workers with
+    // a full deque
+    xmutex lock;
+    xcond wake;
+    Job *inject;
+    int injectHead;
+    volatile u64 injectCount;
+
+    volatile u64 queued;   // Jobs waiting in any queue
+    volatile u64 sleepers; // Workers waiting on wake
+    bool stop;
+} JobState;
+
+static xthreadlocal JobWorker *currentWorker = NULL;
+
+static bool jobPush(JobWorker *w, Job job)
+{
+    u64 b = w->bottom;
+    u64 t = xatomicLoad64(&w->top);
+    if (b - t >= JOB_QUEUE_SIZE)
+        return false;
+
+    w->jobs[b & (JOB_QUEUE_SIZE - 1)] = job;
+    xatomicStore64(&w->bottom, b + 1);
+    return true;
+}
+
+static bool jobPop(JobWorker *w, Job *job)
+{
+    u64 b = w->bottom - 1;
+    xatomicStore64(&w->bottom, b);
+    u64 t = xatomicLoad64(&w->top);
+
+    if ((i64)(b - t) < 0)
+    {
+        xatomicStore64(&w->bottom, t);
+        return false;
+    }
+
+    *job = w->jobs[b & (JOB_QUEUE_SIZE - 1)];
+    if (b != t)
+        return true;
+
+    // Last job, race thieves for it
+    bool won = xatomicCas64(&w->top, t, t + 1) == t;
+    xatomicStore64(&w->bottom, t + 1);
+    return won;
 }
 
-void *ListCreate(size_t dataSize, size_t length)
+static bool jobSteal(JobWorker *w, Job *job)
 {
-    ListHeader header = {
-        .length = 0,
-        .cap = length,
-        .dataSize = dataSize,
-    };
+    u64 t = xatomicLoad64(&w->top);
+    u64 b = xatomicLoad64(&w->bottom);
+    if ((i64)(b - t) <= 0)
+        return false;
 
-    void *listptr = xdefaultAlloc(HEADER_SIZE + (dataSize * length));
-    memcpy(listptr, &header, HEADER_SIZE);
-    return (listptr + HEADER_SIZE);
+    // The slot may be overwritten once top moves on, the CAS catches that
+    *job = w->jobs[t & (JOB_QUEUE_SIZE - 1)];
+    return xatomicCas64(&w->top, t, t + 1) == t;
 }
 
-int ListLen(void *list)
+// Finds a job from the own deque, then the inject queue, then by stealing
+// from the other workers. Self is NULL for threads that are not workers.
+static bool jobFind(JobState *s, JobWorker *self, Job *job)
 {
-    return getHeader(list)->length;
+    bool found = self != NULL && jobPop(self, job);
+
+    if (!found && xatomicLoad64(&s->injectCount) > 0)
+    {
+        xlock(&s->lock);
+        if (s->injectHead < len(s->inject))
+        {
+            *job = s->inject[s->injectHead++];
+            xatomicAdd64(&s->injectCount, -1);
+            found = true;
+            if (s->injectHead == len(s->inject))
+            {
+                listHeader(s->inject)->length = 0;
+                s->injectHead = 0;
+            }
+        }
+        xunlock(&s->lock);
+    }
+
+    u32 start = self != NULL ? self->index + 1 : 0;
+    for (u32 i = 0; !found && i < s->count; i++)
+    {
+        JobWorker *victim = &s->workers[(start + i) % s->count];
+        if (victim != self)
+            found = jobSteal(victim, job);
+    }
+
+    if (found)
+        xatomicAdd64(&s->queued, -1);
+    return found;
 }
 
-int ListCap(void *list)
+// Runs job with the scratch arena of the current thread, which is reset after.
+static void jobRun(Job *job)
 {
-    return getHeader(list)->cap;
+    Arena *scratch = ArenaScratch(NULL);
+    ArenaMark mark = ArenaSave(scratch);
+    job->fn(job->arg, scratch);
+    ArenaRestore(scratch, mark);
+
+    if (job->counter != NULL)
+        xatomicAdd64(&job->counter->pending, -1);
 }
 
-void ListAppend(void *list, u64 item)
+static xthreadResult xthreadCall jobWorkerThread(void *arg)
 {
-    ListHeader *header = getHeader(list);
-    int size = header->dataSize;
+    JobWorker *self = arg;
+    JobState *s = self->state;
+    currentWorker = self;
 
-    if (header->length < header->cap)
+    for (;;)
     {
-        int length = (header->length * size);
+        Job job;
+        if (jobFind(s, self, &job))
+        {
+            jobRun(&job);
+            continue;
+        }
 
-        if (size > sizeof(u64))
-            memcpy(list + length, (void *)item, size);
-        else
-            memcpy(list + length, &item, size);
+        // Sleepers is raised before queued is checked, and JobSubmit raises
+        // queued before it checks sleepers, so a wakeup cannot be missed
+        xlock(&s->lock);
+        xatomicAdd64(&s->sleepers, 1);
+        while ((i64)xatomicLoad64(&s->queued) <= 0 && !s->stop)
+            xcondWait(&s->wake, &s->lock);
+        xatomicAdd64(&s->sleepers, -1);
+        bool stop = s->stop && (i64)xatomicLoad64(&s->queued) <= 0;
+        xunlock(&s->lock);
 
-        header->length++;
+        if (stop)
+            break;
     }
+
+    currentWorker = NULL;
+    ArenaFreeScratch();
+    return 0;
 }
 
-void *ListPop(void *list)
+JobSystem JobSystemNew(u32 threads)
 {
-    ListHeader *header = getHeader(list);
-    header->length--;
-    return list + (header->length * header->dataSize);
+    if (threads == 0)
+        threads = xcpuCount();
+    if (threads > JOB_MAX_THREADS)
+        threads = JOB_MAX_THREADS;
+
+    JobState *s = xdefaultAlloc(sizeof(JobState));
+    char *workerMemory = xdefaultAlloc(sizeof(JobWorker) * threads + CACHE_LINE_SIZE);
+    Job *inject = ListCreate(sizeof(Job), 64);
+    if (s == NULL || workerMemory == NULL || inject == NULL)
+    {
+        if (s != NULL)
+            xdefaultFree(s);
+        if (workerMemory != NULL)
+            xdefaultFree(workerMemory);
+        ListFree(inject);
+        return (JobSystem){.err = ERR_NO_MEMORY};
+    }
+
+    // The default allocator only aligns to 16 bytes
+    u64 addr = (u64)workerMemory;
+    JobWorker *workers = (JobWorker *)(workerMemory + (alignUp(addr, CACHE_LINE_SIZE) - addr));
+
+    *s = (JobState){
+        .workers = workers,
+        .workerMemory = workerMemory,
+        .count = threads,
+        .inject = inject,
+    };
+    xmutexInit(&s->lock);
+    xcondInit(&s->wake);
+
+    for (u32 i = 0; i < threads; i++)
+    {
+        workers[i].top = 0;
+        workers[i].bottom = 0;
+        workers[i].state = s;
+        workers[i].index = i;
+    }
+
+    u32 started = 0;
+    for (; started < threads; started++)
+    {
+        if (!xthreadStart(&workers[started].thread, jobWorkerThread, &workers[started]))
+            break;
+    }
+
+    JobSystem js = {.state = s, .threads = started, .err = ERR_NO_ERROR};
+    if (started < threads)
+    {
+        s->count = started;
+        JobSystemFree(&js);
+        return (JobSystem){.err = ERR_NO_MEMORY};
+    }
+    return js;
 }
 
-void ListFree(void *list)
+void JobSubmit(JobSystem *js, JobFunc fn, void *arg, JobCounter *counter)
 {
-    free(list - HEADER_SIZE);
-}
+    if (fn == NULL)
+        return;
 
-#define returnIfError(s) \
-    if (!Ok(s))          \
-        return (String) { .err = (s).err, .length = 0 }
+    Job job = {.fn = fn, .arg = arg, .counter = counter};
+    if (counter != NULL)
+        xatomicAdd64(&counter->pending, 1);
 
-String StrAlloc(Arena *a, const char *s)
-{
-    if (s == NULL || a == NULL)
-        return (String){.err = ERR_NULL_PTR};
-    returnIfError(*a);
+    // Without a job system the job runs right away
+    if (js == NULL || !Ok(*js))
+    {
+        jobRun(&job);
+        return;
+    }
 
-    int length = strlen(s);
-    char *p = ArenaAlloc(a, length);
-    if (p == NULL)
-        return (String){
-            .err = ERR_NO_MEMORY,
-            .length = 0,
-            .str = NULL,
-        };
+    JobState *s = js->state;
+    JobWorker *self = currentWorker != NULL && currentWorker->state == s ? currentWorker : NULL;
+    if (self == NULL || !jobPush(self, job))
+    {
+        xlock(&s->lock);
+        pushv(s->inject, job);
+        bool pushed = listHeader(s->inject)->err == ERR_NO_ERROR;
+        listHeader(s->inject)->err = ERR_NO_ERROR;
+        if (pushed)
+            xatomicAdd64(&s->injectCount, 1);
+        xunlock(&s->lock);
 
-    memcpy(p, s, length);
-    return (String){
-        .err = ERR_NO_ERROR,
-        .length = length,
-        .str = p,
-    };
+        // Out of memory for the queue, run it here instead of losing it
+        if (!pushed)
+        {
+            jobRun(&job);
+            return;
+        }
+    }
+
+    xatomicAdd64(&s->queued, 1);
+    if (xatomicLoad64(&s->sleepers) > 0)
+    {
+        xlock(&s->lock);
+        xcondWake(&s->wake);
+        xunlock(&s->lock);
+    }
 }
 
-void prints(String s)
+void JobWait(JobSystem *js, JobCounter *counter)
 {
-    if (s.err)
-        printf("STRING_ERROR\n");
-    printf("%.*s\n", s.length, s.str);
+    if (counter == NULL)
+        return;
+
+    JobState *s = js != NULL && Ok(*js) ? js->state : NULL;
+    JobWorker *self = s != NULL && currentWorker != NULL && currentWorker->state == s ? currentWorker : NULL;
+
+    while ((i64)xatomicLoad64(&counter->pending) > 0)
+    {
+        Job job;
+        if (s != NULL && jobFind(s, self, &job))
+            jobRun(&job);
+        else
+            xyield();
+    }
 }
 
-String StrSub(String s, u32 start, u32 end)
+typedef struct JobBatch
 {
-    return (String){
-        .str = s.str + start,
-        .length = end - start,
-        .err = s.err,
-    };
+    char *items;
+    u32 itemSize;
+    u32 first;
+    u32 count;
+    JobForFunc fn;
+    void *ctx;
+} JobBatch;
+
+static void jobRunBatch(void *arg, Arena *scratch)
+{
+    JobBatch *b = arg;
+    for (u32 i = 0; i < b->count; i++)
+    {
+        ArenaMark mark = ArenaSave(scratch);
+        u32 index = b->first + i;
+        b->fn(b->items + (u64)index * b->itemSize, index, b->ctx, scratch);
+        ArenaRestore(scratch, mark);
+    }
 }
 
-u32 _strFindWordEx(String s, char *word, int wordlen)
+void JobParallelFor(JobSystem *js, void *list, JobForFunc fn, void *ctx)
 {
-    for (int i = 0; i < s.length; i++)
+    if (list == NULL || fn == NULL)
+        return;
+
+    u32 count = len(list);
+    if (count == 0)
+        return;
+
+    // A few batches per thread keeps them busy when items take uneven time
+    u32 threads = js != NULL && Ok(*js) ? js->threads + 1 : 1;
+    u32 batches = threads * 4 < count ? threads * 4 : count;
+    JobBatch *b = xdefaultAlloc(sizeof(JobBatch) * batches);
+    JobBatch single;
+    if (b == NULL)
     {
-        if (s.str[i] == word[0])
-        {
-            bool found = true;
-            for (int j = 0; j < wordlen && i + j < s.length; j++)
-                if (s.str[i + j] != word[j])
-                    found = false;
+        b = &single;
+        batches = 1;
+    }
 
-            if (found)
-                return i;
-        }
+    JobCounter counter = {0};
+    u32 first = 0;
+    for (u32 i = 0; i < batches; i++)
+    {
+        u32 n = count / batches + (i < count % batches);
+        b[i] = (JobBatch){
+            .items = list,
+            .itemSize = listHeader(list)->dataSize,
+            .first = first,
+            .count = n,
+            .fn = fn,
+            .ctx = ctx,
+        };
+        JobSubmit(js, jobRunBatch, &b[i], &counter);
+        first += n;
     }
-    return -1;
+
+    JobWait(js, &counter);
+    if (b != &single)
+        xdefaultFree(b);
 }
 
-u32 StrFindWord(String s, char *word)
+error JobSystemFree(JobSystem *js)
 {
-    return _strFindWordEx(s, word, strlen(word));
+    if (js == NULL)
+        return ERR_NULL_PTR;
+    if (js->state == NULL)
+        return js->err;
+
+    JobState *s = js->state;
+    xlock(&s->lock);
+    s->stop = true;
+    xcondWakeAll(&s->wake);
+    xunlock(&s->lock);
+
+    for (u32 i = 0; i < s->count; i++)
+    {
+        xthreadJoin(s->workers[i].thread);
+    }
+
+    ListFree(s->inject);
+    xdefaultFree(s->workerMemory);
+    xdefaultFree(s);
+    js->state = NULL;
+    js->threads = 0;
+    return ERR_NO_ERROR;
 }
 
-u32 StrFindString(String s, String word)
+// Rounds n up to a power of two, at least 2.
+static u64 queueCapacity(u32 n)
 {
-    return _strFindWordEx(s, word.str, word.length);
+    u64 cap = 2;
+    while (cap < n)
+        cap <<= 1;
+    return cap;
 }
 
-String StrCopy(Arena *a, String s)
+// Producer and consumer each own a cache line. Each keeps a copy of the other
+// side's index and only reads the shared one when its copy says the queue is
+// full or empty.
+typedef struct SpscState
 {
-    if (a == NULL)
-        return (String){.err = ERR_NULL_PTR};
-    returnIfError(s);
+    u8 *items;
+    u64 mask;
+    u32 itemSize;
+    u8 _pad0[CACHE_LINE_SIZE - 20];
 
-    char *str = ArenaAlloc(a, s.length);
-    if (str == NULL)
-        return (String){.err = ERR_NO_MEMORY};
+    volatile u64 head; // Written by consumer
+    u64 cachedTail;
+    u8 _pad1[CACHE_LINE_SIZE - 16];
 
-    memcpy(str, s.str, s.length);
-    return (String){.err = ERR_NO_ERROR, .length = s.length, .str = str};
-}
+    volatile u64 tail; // Written by producer
+    u64 cachedHead;
+    u8 _pad2[CACHE_LINE_SIZE - 16];
+} SpscState;
 
-char CharAt(String s, u32 pos)
+SpscQueue SpscNew(Arena *a, u32 itemSize, u32 cap)
 {
-    if (!Ok(s))
-        panic("CharAt on string with error\n");
-    if (s.length <= pos)
-        panic("string index out of bounds\n");
+    if (a == NULL)
+        return (SpscQueue){.err = ERR_NULL_PTR};
+    if (!Ok(*a))
+        return (SpscQueue){.err = a->err};
 
-    return *(s.str + pos);
+    u64 slots = queueCapacity(cap);
+    SpscState *s = ArenaAllocAligned(a, sizeof(SpscState), CACHE_LINE_SIZE);
+    u8 *items = ArenaAllocAligned(a, slots * itemSize, CACHE_LINE_SIZE);
+    if (s == NULL || items == NULL)
+        return (SpscQueue){.err = ERR_NO_MEMORY};
+
+    memset(s, 0, sizeof(SpscState));
+    s->items = items;
+    s->mask = slots - 1;
+    s->itemSize = itemSize;
+    return (SpscQueue){.state = s, .err = ERR_NO_ERROR};
 }
 
-u32 StrCount(String s, char c)
+// Copies count items between the ring at index pos and the flat array items,
+// in up to two parts when the range wraps around.
+static void ringCopy(u8 *ring, u64 mask, u32 itemSize, u64 pos, u8 *items, u64 count, bool in)
 {
-    if (!Ok(s))
-        return 0;
+    u64 start = pos & mask;
+    u64 first = count < mask + 1 - start ? count : mask + 1 - start;
+    u8 *slot = ring + start * itemSize;
 
-    int count = 0;
-    for (int i = 0; i < s.length; i++)
+    if (in)
     {
-        if (CharAt(s, i) == c)
-            count++;
+        memcpy(slot, items, first * itemSize);
+        memcpy(ring, items + first * itemSize, (count - first) * itemSize);
+    }
+    else
+    {
+        memcpy(items, slot, first * itemSize);
+        memcpy(items + first * itemSize, ring, (count - first) * itemSize);
     }
-    return count;
 }
 
-String StrUpper(Arena *a, String s)
+u32 SpscPushN(SpscQueue *q, const void *items, u32 count)
 {
-    if (a == NULL)
-        return (String){.err = ERR_NULL_PTR};
-    returnIfError(s);
+    if (q == NULL || !Ok(*q) || items == NULL)
+        return 0;
 
-    String upper = StrCopy(a, s);
-    returnIfError(upper);
+    SpscState *s = q->state;
+    u64 tail = s->tail;
+    u64 cap = s->mask + 1;
+    if (tail - s->cachedHead + count > cap)
+        s->cachedHead = xloadAcquire64(&s->head);
 
-    for (int i = 0; i < s.length; i++)
-    {
-        char c = CharAt(s, i);
-        if (c >= 'a' && c <= 'z')
-            c -= 32;
-        *(upper.str + i) = c;
-    }
+    u64 room = cap - (tail - s->cachedHead);
+    u64 n = count < room ? count : room;
+    if (n == 0)
+        return 0;
 
-    return upper;
+    ringCopy(s->items, s->mask, s->itemSize, tail, (u8 *)items, n, true);
+    xstoreRelease64(&s->tail, tail + n);
+    return n;
 }
 
-String StrLower(Arena *a, String s)
+u32 SpscPopN(SpscQueue *q, void *items, u32 max)
 {
-    if (a == NULL)
-        return (String){.err = ERR_NULL_PTR};
-    returnIfError(s);
+    if (q == NULL || !Ok(*q) || items == NULL)
+        return 0;
 
-    String lower = StrCopy(a, s);
-    returnIfError(lower);
+    SpscState *s = q->state;
+    u64 head = s->head;
+    if (s->cachedTail - head < max)
+        s->cachedTail = xloadAcquire64(&s->tail);
 
-    for (int i = 0; i < s.length; i++)
-    {
-        char c = CharAt(s, i);
-        if (c >= 'A' && c <= 'Z')
-            c += 32;
-        *(lower.str + i) = c;
-    }
+    u64 available = s->cachedTail - head;
+    u64 n = max < available ? max : available;
+    if (n == 0)
+        return 0;
 
-    return lower;
+    ringCopy(s->items, s->mask, s->itemSize, head, items, n, false);
+    xstoreRelease64(&s->head, head + n);
+    return n;
 }
 
-StringIter StrToIterator(String s)
+bool SpscPush(SpscQueue *q, const void *item)
 {
-    return (StringIter){
-        .err = s.err,
-        .pos = 0,
-        .s = s,
-    };
+    return SpscPushN(q, item, 1) == 1;
 }
 
-StringIter StrToIteratorEx(char *string, u32 length)
+bool SpscPop(SpscQueue *q, void *item)
 {
-    return (StringIter){
-        .err = 0,
-        .pos = 0,
-        .s = (String){
-            .err = 0,
-            .str = string,
-            .length = length,
-        },
-    };
+    return SpscPopN(q, item, 1) == 1;
 }
 
-String StrSplit(StringIter *iter, char delim)
+// Bounded queue by Dmitry Vyukov. Every cell has a sequence number telling
+// which lap of the ring it is ready for, so producers and consumers only
+// contend on their own index.
+typedef struct MpmcState
 {
-    if (iter == NULL)
-        return (String){.err = ERR_NULL_PTR};
-    if (!Ok(*iter))
-        return (String){.err = iter->err};
+    u8 *cells;
+    u64 mask;
+    u32 itemSize;
+    u32 cellSize; // Sequence number followed by the item
+    u8 _pad0[CACHE_LINE_SIZE - 24];
+
+    volatile u64 head;
+    u8 _pad1[CACHE_LINE_SIZE - 8];
+
+    volatile u64 tail;
+    u8 _pad2[CACHE_LINE_SIZE - 8];
+} MpmcState;
+
+#define mpmcSeq(s, pos) ((volatile u64 *)((s)->cells + ((pos) & (s)->mask) * (s)->cellSize))
+
+MpmcQueue MpmcNew(Arena *a, u32 itemSize, u32 cap)
+{
+    if (a == NULL)
+        return (MpmcQueue){.err = ERR_NULL_PTR};
+    if (!Ok(*a))
+        return (MpmcQueue){.err = a->err};
 
-    int start = iter->pos;
-    while (iter->pos < iter->s.length)
+    u64 slots = queueCapacity(cap);
+    u32 cellSize = alignUp(sizeof(u64) + itemSize, sizeof(u64));
+    MpmcState *s = ArenaAllocAligned(a, sizeof(MpmcState), CACHE_LINE_SIZE);
+    u8 *cells = ArenaAllocAligned(a, slots * cellSize, CACHE_LINE_SIZE);
+    if (s == NULL || cells == NULL)
+        return (MpmcQueue){.err = ERR_NO_MEMORY};
+
+    memset(s, 0, sizeof(MpmcState));
+    s->cells = cells;
+    s->mask = slots - 1;
+    s->itemSize = itemSize;
+    s->cellSize = cellSize;
+    for (u64 i = 0; i < slots; i++)
+        *mpmcSeq(s, i) = i;
+
+    return (MpmcQueue){.state = s, .err = ERR_NO_ERROR};
+}
+
+// Claims up to count consecutive cells starting at the index, for producers
+// when ready is 0 and consumers when it is 1. Returns number claimed and the
+// first position in pos.
+static u64 mpmcClaim(MpmcState *s, volatile u64 *index, u64 count, u64 ready, u64 *pos)
+{
+    // Nothing to claim, the retry below would spin on a ready cell
+    if (count == 0)
+        return 0;
+
+    u64 p = xloadAcquire64(index);
+    for (;;)
     {
-        char c = CharAt(iter->s, iter->pos);
-        if (c == delim)
-        {
-            char *str = iter->s.str + start;
-            int length = iter->pos - start;
-            iter->pos += 1;
+        // A cell is ready for this lap when its sequence is p + ready
+        u64 n = 0;
+        while (n < count && xloadAcquire64(mpmcSeq(s, p + n)) == p + n + ready)
+            n++;
 
-            return (String){
-                .length = length,
-                .str = str,
-                .err = ERR_NO_ERROR,
-            };
+        if (n == 0)
+        {
+            i64 diff = (i64)(xloadAcquire64(mpmcSeq(s, p)) - (p + ready));
+            if (diff < 0)
+                return 0; // Full or empty
+            p = xloadAcquire64(index);
+            continue;
         }
 
-        iter->pos++;
+        u64 prev = xatomicCas64(index, p, p + n);
+        if (prev == p)
+        {
+            *pos = p;
+            return n;
+        }
+        p = prev;
     }
-
-    iter->err = ERR_ITERATION_FINISH;
-    return (String){
-        .length = iter->pos - start,
-        .str = iter->s.str + start,
-        .err = ERR_NO_ERROR,
-    };
 }
 
-u32 StrFind(String s, char c)
+u32 MpmcPushN(MpmcQueue *q, const void *items, u32 count)
 {
-    if (!Ok(s))
-        return -1;
-    for (int i = 0; i < s.length; i++)
-        if (CharAt(s, i) == c)
-            return i;
-    return -1;
+    if (q == NULL || !Ok(*q) || items == NULL)
+        return 0;
+
+    MpmcState *s = q->state;
+    u64 pos;
+    u64 n = mpmcClaim(s, &s->tail, count, 0, &pos);
+
+    for (u64 i = 0; i < n; i++)
+    {
+        volatile u64 *seq = mpmcSeq(s, pos + i);
+        memcpy((u8 *)seq + sizeof(u64), (const u8 *)items + i * s->itemSize, s->itemSize);
+        xstoreRelease64(seq, pos + i + 1);
+    }
+    return n;
 }
 
-String StrConcat(Arena *a, String s1, String s2)
+u32 MpmcPopN(MpmcQueue *q, void *items, u32 max)
 {
-    if (a == NULL)
-        return (String){.err = ERR_NULL_PTR};
-    returnIfError(s1);
-    returnIfError(s2);
+    if (q == NULL || !Ok(*q) || items == NULL)
+        return 0;
 
-    int length = s1.length + s2.length;
-    char *str = ArenaAlloc(a, length);
-    memcpy(str, s1.str, s1.length);
-    memcpy(str + s1.length, s2.str, s2.length);
-    return (String){
-        .err = ERR_NO_ERROR,
-        .str = str,
-        .length = length,
-    };
+    MpmcState *s = q->state;
+    u64 pos;
+    u64 n = mpmcClaim(s, &s->head, max, 1, &pos);
+
+    for (u64 i = 0; i < n; i++)
+    {
+        volatile u64 *seq = mpmcSeq(s, pos + i);
+        memcpy((u8 *)items + i * s->itemSize, (u8 *)seq + sizeof(u64), s->itemSize);
+        xstoreRelease64(seq, pos + i + s->mask + 1);
+    }
+    return n;
 }
 
-bool StrCompare(String a, String b)
+bool MpmcPush(MpmcQueue *q, const void *item)
 {
-    if (!Ok(a) || !Ok(b))
-        return false;
-    if (a.length != b.length)
-        return false;
-    for (int i = 0; i < a.length; i++)
-        if (CharAt(a, i) != CharAt(b, i))
-            return false;
-    return true;
+    return MpmcPushN(q, item, 1) == 1;
+}
+
+bool MpmcPop(MpmcQueue *q, void *item)
+{
+    return MpmcPopN(q, item, 1) == 1;
 }
 
 #endif
\ No newline at end of file